@@ -0,0 +1,112 @@
+/*
+ * microbenchmark of the process table (see src/signals.h)
+ *
+ * adds, looks up by pid, id and category, queues events for and removes several thousand entries
+ * usage: plist-bench [entries]
+ */
+#include "../src/common.h"
+#include "../src/desktop-application.h"
+#include "../src/signals.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_ENTRIES     5000
+#define CATEGORIES          64
+#define PID_BASE            1000
+
+static double elapsed(const struct timespec *start);
+static void report(const char *name, const struct timespec *start, int n);
+
+static struct dcategory categories[CATEGORIES];
+static char category_names[CATEGORIES][32];
+
+
+double elapsed(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) * 1e9 + (double) (now.tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char *argv[]) {
+    int i, n, found;
+    char (*id_names)[32];
+    struct dapplication *apps;
+    struct timespec start;
+
+    n = argc > 1 ? atoi(argv[1]) : DEFAULT_ENTRIES;
+    if (n <= 0) {
+        fprintf(stderr, "Usage: %s [entries]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    apps = calloc((size_t) n, sizeof(struct dapplication));
+    id_names = calloc((size_t) n, sizeof(*id_names));
+    if (!apps || !id_names)
+        die("Unable to allocate memory for benchmark");
+    for (i = 0; i < CATEGORIES; i++) {
+        snprintf(category_names[i], sizeof(category_names[i]), "category%d", i);
+        categories[i].name = category_names[i];
+    }
+    for (i = 0; i < n; i++) {
+        snprintf(id_names[i], sizeof(id_names[i]), "app%d.desktop", i);
+        apps[i].id_name = id_names[i];
+        apps[i].category = &categories[i % CATEGORIES];
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++)
+        plist_add(PID_BASE + i, &apps[i]);
+    report("add", &start, n);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0, found = 0; i < n; i++)
+        found += plist_get(PID_BASE + i) != NULL;
+    report("get by pid", &start, n);
+    if (found != n)
+        die("Lookup by pid failed");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0, found = 0; i < n; i++)
+        found += plist_search(id_names[i], NULL) != NULL;
+    report("search by id", &start, n);
+    if (found != n)
+        die("Lookup by id failed");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0, found = 0; i < n; i++)
+        found += plist_search(NULL, category_names[i % CATEGORIES]) != NULL;
+    report("search by category", &start, n);
+    if (found != n)
+        die("Lookup by category failed");
+
+    /* every entry changes twice, but is only queued once */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < 2 * n; i++)
+        plist_set_status(PID_BASE + i % n, i);
+    for (found = 0; plist_next_event(); found++);
+    report("set status and drain", &start, 2 * n);
+    if (found != n)
+        die("Unexpected number of events");
+
+    /* removing queued entries has to unlink them from the ready queue as well */
+    for (i = 0; i < n; i += 2)
+        plist_set_status(PID_BASE + i, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++)
+        plist_remove(PID_BASE + i);
+    report("remove", &start, n);
+    if (plist_peek() || plist_next_event())
+        die("Entries left after removal");
+
+    free(apps);
+    free(id_names);
+    return EXIT_SUCCESS;
+}
+
+void report(const char *name, const struct timespec *start, int n) {
+    double ns = elapsed(start);
+
+    printf("%-22s %8d ops %10.3f ms %8.1f ns/op\n", name, n, ns / 1e6, ns / n);
+}
@@ -27,6 +27,8 @@ X11_SUPPORT			= true 		# requires xrandr
 IMLIB2_SUPPORT		= true
 CANBERRA_SUPPORT	= true
 LIBNOTIFY_SUPPORT 	= true
+PULSE_SUPPORT		= true 		# pactl is used otherwise
+# LOGIND_SUPPORT		= true 		# unprivileged backlight control, requires libsystemd
 
 # x11 support
 ifdef X11_SUPPORT
@@ -56,5 +58,17 @@ DEPENDENCIES	+= libnotify
 CFLAGS		+= -DLIBNOTIFY
 endif
 
+# libpulse support
+ifdef PULSE_SUPPORT
+DEPENDENCIES	+= libpulse
+CFLAGS		+= -DPULSE
+endif
+
+# logind support
+ifdef LOGIND_SUPPORT
+DEPENDENCIES	+= libsystemd
+CFLAGS		+= -DLOGIND
+endif
+
 CFLAGS		+= `pkg-config --cflags $(DEPENDENCIES)`
 LIBS		+= `pkg-config --libs $(DEPENDENCIES)`
@@ -0,0 +1,96 @@
+#ifdef PULSE
+
+#include "audio-control.h"
+#include "common.h"
+#include "events.h"
+#include "pulse-utils.h"
+#ifdef CANBERRA
+#include <canberra.h>
+#endif /* CANBERRA */
+#include <errno.h>
+#include <string.h>
+
+#define AUDIO_SOUND_HINT        "pademelon"
+#define AUDIO_SOUND_CHANGE      "audio-volume-change"
+
+static int apply(void);
+static void frame_handler(void *data);
+static int schedule(void);
+
+static int frame_timer = -1; /* changes are only queued while it is running */
+static int pending = 0, pending_delta = 0, pending_volume = -1, pending_sound = 0;
+#ifdef CANBERRA
+static ca_context *sound_context = NULL;
+#endif /* CANBERRA */
+
+
+int apply(void) {
+    int status;
+
+    /* queued changes are relative to the last absolute volume, if there is one */
+    if (pending_volume >= 0)
+        status = pulse_set_volume(pending_volume + pending_delta);
+    else
+        status = pulse_change_volume(pending_delta, NULL);
+
+#ifdef CANBERRA
+    /* played asynchronously by libcanberra, so no child process is needed */
+    if (status && pending_sound && (sound_context || ca_context_create(&sound_context) == 0))
+        ca_context_play(sound_context, 0,
+                CA_PROP_EVENT_ID, AUDIO_SOUND_CHANGE,
+                CA_PROP_EVENT_DESCRIPTION, AUDIO_SOUND_HINT,
+                NULL);
+#endif /* CANBERRA */
+
+    pending = pending_delta = pending_sound = 0;
+    pending_volume = -1;
+
+    /* changes arriving in the meantime are collected until the end of the frame */
+    frame_timer = events_add_timer(AUDIO_FRAME_INTERVAL, &frame_handler, NULL);
+    if (frame_timer < 0)
+        DBGPRINT("Unable to start audio frame: %s\n", strerror(errno));
+    return status;
+}
+
+int audio_change_volume(int delta, int play_sound) {
+    pending = 1;
+    pending_delta += delta;
+    pending_sound |= play_sound;
+    return schedule();
+}
+
+void audio_free(void) {
+    if (frame_timer >= 0)
+        events_remove(frame_timer);
+    frame_timer = -1;
+    pulse_deinit();
+#ifdef CANBERRA
+    if (sound_context)
+        ca_context_destroy(sound_context);
+    sound_context = NULL;
+#endif /* CANBERRA */
+}
+
+int audio_set_volume(int volume) {
+    /* an absolute volume makes earlier changes obsolete */
+    pending = 1;
+    pending_delta = 0;
+    pending_volume = MAX_INT(volume, 0);
+    return schedule();
+}
+
+void frame_handler(void *data) {
+    (void) data;
+    /* the timer has been removed by the event loop */
+    frame_timer = -1;
+    if (pending)
+        apply();
+}
+
+int schedule(void) {
+    if (frame_timer >= 0)
+        return 1;
+    return apply();
+}
+
+#endif /* PULSE */
@@ -0,0 +1,19 @@
+#ifndef H_AUDIO_CONTROL
+#define H_AUDIO_CONTROL
+
+#define AUDIO_FRAME_INTERVAL    30 /* milliseconds, volume changes within are applied together */
+
+/*
+ * resident volume control of the daemon (requires PULSE)
+ *
+ * the first change of a burst is applied right away, changes arriving within the following frame
+ * are merged and applied with a single request at its end, so key repeats never queue up
+ * the connection to the sound server is kept open until audio_free()
+ * returns 1 if the change was applied or queued, 0 on error
+ */
+int audio_change_volume(int delta, int play_sound);
+/* set the volume in percent, replaces changes queued before */
+int audio_set_volume(int volume);
+void audio_free(void);
+
+#endif /* H_AUDIO_CONTROL */
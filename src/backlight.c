@@ -0,0 +1,252 @@
+#include "backlight.h"
+#include "common.h"
+#ifdef LOGIND
+#include <systemd/sd-bus.h>
+#endif /* LOGIND */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define LOGIND_SERVICE      "org.freedesktop.login1"
+#define LOGIND_SESSION      "/org/freedesktop/login1/session/auto"
+#define LOGIND_INTERFACE    "org.freedesktop.login1.Session"
+
+static int fade(long from, long to, long fade_milli);
+#ifdef LOGIND
+static int logind_set_brightness(long value);
+#endif /* LOGIND */
+static int read_long(const char *dir, const char *file, long *value);
+static int type_priority(const char *dir);
+static int write_brightness(long value);
+
+/* interface types in order of preference, firmware interfaces know the range of the panel best */
+static const char *types[] = { "firmware", "platform", "raw", NULL };
+
+static char *device = NULL; /* directory of the selected device */
+static long max_brightness = 0;
+static int brightness_fd = -1; /* -1 if brightness is not writable */
+#ifdef LOGIND
+static sd_bus *bus = NULL;
+#endif /* LOGIND */
+
+
+int backlight_change(int delta, long fade_milli) {
+    long from, to;
+
+    if (!backlight_init() || !read_long(device, "brightness", &from))
+        return 0;
+
+    /* devices with few steps would not change at all if the delta was rounded away */
+    to = from + ((long) delta * max_brightness + (delta < 0 ? -50 : 50)) / 100;
+    if (to == from && delta != 0)
+        to += delta < 0 ? -1 : 1;
+    to = to < 0 ? 0 : to > max_brightness ? max_brightness : to;
+    return fade(from, to, fade_milli);
+}
+
+void backlight_deinit(void) {
+    if (brightness_fd >= 0)
+        close(brightness_fd);
+    free(device);
+#ifdef LOGIND
+    if (bus)
+        sd_bus_flush_close_unref(bus);
+    bus = NULL;
+#endif /* LOGIND */
+    brightness_fd = -1;
+    device = NULL;
+    max_brightness = 0;
+}
+
+int backlight_get(int *percentage) {
+    long value;
+
+    if (!backlight_init() || !read_long(device, "brightness", &value))
+        return 0;
+    *percentage = (int) ((value * 100 + max_brightness / 2) / max_brightness);
+    return 1;
+}
+
+int backlight_init(void) {
+    int priority, best = -1;
+    long max;
+    char *root, *path;
+    DIR *dir;
+    struct dirent *entry;
+
+    if (device)
+        return 1;
+
+    root = getenv(BACKLIGHT_ROOT_ENV);
+    if (!root || !root[0])
+        root = BACKLIGHT_ROOT;
+    dir = opendir(root);
+    if (!dir)
+        return 0;
+
+    /* the entries are symlinks to the devices, ties are broken by name to be deterministic */
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        path = malloc(strlen(root) + strlen(entry->d_name) + 2);
+        if (!path)
+            die("Unable to allocate memory for backlight device");
+        sprintf(path, "%s/%s", root, entry->d_name);
+
+        priority = type_priority(path);
+        if (read_long(path, "max_brightness", &max) && max > 0 && (best < 0 || priority < best
+                    || (priority == best && strcmp(path, device) < 0))) {
+            free(device);
+            device = path;
+            max_brightness = max;
+            best = priority;
+        } else {
+            free(path);
+        }
+    }
+    closedir(dir);
+    if (!device)
+        return 0;
+
+    /* writable for root or with a udev rule, logind is asked otherwise */
+    char brightness_path[strlen(device) + strlen("/brightness") + 1];
+    sprintf(brightness_path, "%s/brightness", device);
+    brightness_fd = open(brightness_path, O_WRONLY | O_CLOEXEC);
+    if (brightness_fd == -1) {
+        DBGPRINT("Unable to open '%s': %s\n", brightness_path, strerror(errno));
+#ifndef LOGIND
+        backlight_deinit();
+        return 0;
+#endif /* LOGIND */
+    }
+    return 1;
+}
+
+int backlight_set(int percentage, long fade_milli) {
+    long from, to;
+
+    if (!backlight_init() || !read_long(device, "brightness", &from))
+        return 0;
+
+    percentage = MIN_INT(percentage, 100);
+    percentage = MAX_INT(percentage, 0);
+    to = ((long) percentage * max_brightness + 50) / 100;
+    return fade(from, to, fade_milli);
+}
+
+int fade(long from, long to, long fade_milli) {
+    int timer, status = 1, written = 0;
+    long i, steps;
+    uint64_t expirations;
+    struct itimerspec its = {0};
+
+    /* a step is never smaller than one unit of the device */
+    steps = fade_milli / BACKLIGHT_FADE_INTERVAL;
+    if (steps > labs(to - from))
+        steps = labs(to - from);
+    if (steps <= 1)
+        return write_brightness(to);
+
+    timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    its.it_value.tv_nsec = its.it_interval.tv_nsec = BACKLIGHT_FADE_INTERVAL * 1000000L;
+    if (timer == -1 || timerfd_settime(timer, 0, &its, NULL) == -1) {
+        if (timer >= 0)
+            close(timer);
+        return write_brightness(to);
+    }
+
+    /* steps are taken from the timer, so slow writes shorten the fade instead of stretching it */
+    for (i = 0; status && i < steps; ) {
+        if (read(timer, &expirations, sizeof(expirations)) != (ssize_t) sizeof(expirations)) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        i = (long) expirations >= steps - i ? steps : i + (long) expirations;
+        status = write_brightness(from + (to - from) * i / steps);
+        written |= status;
+    }
+    close(timer);
+
+    /* make sure the fade ends at its target even if the timer has failed */
+    if (status && i < steps)
+        status = write_brightness(to);
+    return status ? 1 : written ? -1 : 0;
+}
+
+#ifdef LOGIND
+int logind_set_brightness(long value) {
+    int r;
+    const char *name;
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+
+    if (!bus && sd_bus_open_system(&bus) < 0) {
+        bus = NULL;
+        return 0;
+    }
+
+    /* logind checks that the caller owns the active session of the seat */
+    name = strrchr(device, '/') + 1;
+    r = sd_bus_call_method(bus, LOGIND_SERVICE, LOGIND_SESSION, LOGIND_INTERFACE, "SetBrightness", &error,
+            NULL, "ssu", "backlight", name, (uint32_t) value);
+    if (r < 0)
+        DBGPRINT("Unable to set brightness through logind: %s\n", error.message ? error.message : strerror(-r));
+    sd_bus_error_free(&error);
+    return r >= 0;
+}
+#endif /* LOGIND */
+
+int read_long(const char *dir, const char *file, long *value) {
+    FILE *f;
+    int status;
+    char path[strlen(dir) + strlen(file) + 2];
+
+    sprintf(path, "%s/%s", dir, file);
+    f = fopen(path, "r");
+    if (!f)
+        return 0;
+    status = fscanf(f, "%ld", value) == 1;
+    fclose(f);
+    return status;
+}
+
+int type_priority(const char *dir) {
+    int i;
+    FILE *f;
+    char path[strlen(dir) + strlen("/type") + 1], type[16];
+
+    /* devices without a known type come last */
+    sprintf(path, "%s/type", dir);
+    type[0] = '\0';
+    if ((f = fopen(path, "r"))) {
+        if (fscanf(f, "%15s", type) != 1)
+            type[0] = '\0';
+        fclose(f);
+    }
+
+    for (i = 0; types[i] && strcmp(type, types[i]) != 0; i++);
+    return i;
+}
+
+int write_brightness(long value) {
+    int len;
+    char buffer[32];
+
+    if (brightness_fd < 0) {
+#ifdef LOGIND
+        return logind_set_brightness(value);
+#else /* LOGIND */
+        return 0;
+#endif /* LOGIND */
+    }
+
+    /* sysfs attributes are rewritten from the start */
+    len = snprintf(buffer, sizeof(buffer), "%ld\n", value);
+    return pwrite(brightness_fd, buffer, (size_t) len, 0) == (ssize_t) len;
+}
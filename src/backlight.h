@@ -0,0 +1,28 @@
+#ifndef H_BACKLIGHT
+#define H_BACKLIGHT
+
+#define BACKLIGHT_ROOT              "/sys/class/backlight"
+#define BACKLIGHT_ROOT_ENV          "PADEMELON_BACKLIGHT_ROOT" /* overrides BACKLIGHT_ROOT, e.g. for tests */
+#define BACKLIGHT_FADE_DURATION     150 /* milliseconds */
+#define BACKLIGHT_FADE_INTERVAL     15  /* milliseconds between two steps of a fade */
+
+/*
+ * screen backlight controlled through sysfs
+ *
+ * backlight_init() picks a device (firmware before platform before raw interfaces) and caches its
+ * max_brightness, brightness is written directly or, if that is not permitted and pademelon was built
+ * with LOGIND, through SetBrightness() of the logind session
+ * without LOGIND, backlight_init() fails if the device is not writable
+ * percentages are relative to max_brightness
+ * all functions return 1 on success and 0 otherwise (e.g. if there is no backlight device),
+ * backlight_change() and backlight_set() return -1 if a fade has failed after changing the brightness
+ */
+int backlight_init(void);
+void backlight_deinit(void);
+/* relative change, which is at least one step of the device if delta is not 0 */
+int backlight_change(int delta, long fade_milli);
+int backlight_get(int *percentage);
+/* fade to the given brightness within fade_milli milliseconds, 0 sets it right away */
+int backlight_set(int percentage, long fade_milli);
+
+#endif /* H_BACKLIGHT */
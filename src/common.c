@@ -11,10 +11,15 @@ const char *name = "pademelon";
 const char *sysconf = "/etc/%s/%s";
 const char *sysdata = "/usr/share/%s/%s";
 const char *syslocaldata = "/usr/local/share/%s/%s";
+const char *sysdatadirs = "%.*s/%s/%s";
 const char *userconf = "%s/%s/%s";
 const char *userdata = "%s/%s/%s";
+const char *usercache = "%s/%s/%s";
+const char *userruntime = "%s/%s/%s";
 char *def_userconf = "%s/.config";
 char *def_userdata = "%s/.local/share";
+char *def_usercache = "%s/.cache";
+char *def_sysdatadirs = "/usr/local/share:/usr/share";
 
 void bye(const char *msg) {
     fprintf(stderr,"%s\n", msg);
@@ -121,6 +126,46 @@ char *system_data_path(char *file) {
     return path;
 }
 
+char **system_data_dirs(char *file) {
+    size_t n = 0, len;
+    char **paths, *file_cpy;
+    const char *xdg_dirs, *dir, *end;
+    file_cpy = file ? file : "";
+
+    /* dirs are separated by colons and listed in order of priority */
+    xdg_dirs = getenv("XDG_DATA_DIRS");
+    if (!xdg_dirs || xdg_dirs[0] == '\0')
+        xdg_dirs = def_sysdatadirs;
+
+    /* allocate space for the list (one more than the number of colons); must be freed by user */
+    for (len = 1, dir = xdg_dirs; *dir; dir++)
+        if (*dir == ':')
+            len++;
+    paths = malloc(sizeof(char *) * (len + 1));
+    if (!paths)
+        die("Unable to allocate memory for the system data dirs");
+
+    for (dir = xdg_dirs; ; dir = end + 1) {
+        end = strchr(dir, ':');
+        len = end ? (size_t) (end - dir) : strlen(dir);
+
+        /* relative paths are invalid and ignored */
+        if (len > 0 && dir[0] == '/') {
+            paths[n] = malloc(strlen(sysdatadirs) + len + strlen(name) + strlen(file_cpy) + 1);
+            if (!paths[n])
+                die("Unable to allocate memory for the system data dirs");
+            /* configure data dir according to sysdatadirs variable, program name and file_cpy */
+            if (sprintf(paths[n], sysdatadirs, (int) len, dir, name, file_cpy) < 0)
+                die("Unable to configure the system data dirs");
+            n++;
+        }
+        if (!end)
+            break;
+    }
+    paths[n] = NULL;
+    return paths;
+}
+
 char *system_local_data_path(char *file) {
     char *path, *file_cpy;
     file_cpy = file ? file : "";
@@ -178,3 +223,52 @@ char *user_data_path(char *file) {
         die("Unable to configure the user data dir");
     return path;
 }
+
+char *user_cache_path(char *file) {
+    char *path, *file_cpy, *xdg_cache;
+    file_cpy = file ? file : "";
+
+    /* get cache dir */
+    if (!getenv("HOME"))
+        die("Unable to read $HOME variable");
+    xdg_cache = getenv("XDG_CACHE_HOME");
+    char home_cache[strlen(def_usercache) + strlen(getenv("HOME")) + 1];
+    if(sprintf(home_cache, def_usercache, getenv("HOME")) < 0)
+        die("Unable to configure fallback user cache dir");
+
+    /* allocate space for the string; must be freed by user */
+    path = malloc(strlen(usercache) + strlen(xdg_cache ? xdg_cache : home_cache) + strlen(name) + strlen(file_cpy) + 1);
+    if (!path)
+        die("Unable to allocate memory for the user cache dir");
+    /* configure cache dir according to usercache variable, program name and file_cpy */
+    if (sprintf(path, usercache, xdg_cache ? xdg_cache : home_cache, name, file_cpy) < 0)
+        die("Unable to configure the user cache dir");
+    return path;
+}
+
+char *user_runtime_path(char *file) {
+    char *path, *file_cpy, *xdg_runtime;
+    file_cpy = file ? file : "";
+
+    /* there is no sensible fallback for the runtime dir */
+    xdg_runtime = getenv("XDG_RUNTIME_DIR");
+    if (!xdg_runtime || !*xdg_runtime) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    /* allocate space for the string; must be freed by user */
+    path = malloc(strlen(userruntime) + strlen(xdg_runtime) + strlen(name) + strlen(file_cpy) + 1);
+    if (!path)
+        die("Unable to allocate memory for the user runtime dir");
+    /* the dir itself is created, so sockets and state files can be placed there directly */
+    if (sprintf(path, "%s/%s", xdg_runtime, name) < 0)
+        die("Unable to configure the user runtime dir");
+    if (mkdir(path, S_IRWXU) == -1 && errno != EEXIST) {
+        free(path);
+        return NULL;
+    }
+    if (sprintf(path, userruntime, xdg_runtime, name, file_cpy) < 0)
+        die("Unable to configure the user runtime dir");
+    return path;
+}
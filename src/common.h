@@ -40,13 +40,27 @@ char *system_config_path(char *file);
 char *system_data_path(char *file);
 char *system_local_data_path(char *file);
 
+/*
+ * get the data dirs listed in $XDG_DATA_DIRS (in order of priority) with the given file appended
+ *
+ * the returned list is NULL terminated and must be freed by the user
+ */
+char **system_data_dirs(char *file);
+
 /*
  * get a user config file or the user config file path
  *
  * if the file or dir is not found NULL is returned
  * if an error occurred NULL is returned and the errno is set
  */
+char *user_cache_path(char *file);
 char *user_config_path(char *file);
 char *user_data_path(char *file);
+/*
+ * get a file in the user runtime dir ($XDG_RUNTIME_DIR/pademelon), which is created if necessary
+ *
+ * if $XDG_RUNTIME_DIR is not set or the dir cannot be created NULL is returned and the errno is set
+ */
+char *user_runtime_path(char *file);
 
 #endif /* H_COMMON */
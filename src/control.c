@@ -0,0 +1,308 @@
+#define _GNU_SOURCE /* accept4() */
+#include "common.h"
+#include "control.h"
+#include "events.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+struct control_client {
+    int fd;
+    int failed; /* an answer could not be sent */
+    size_t len;
+    char buffer[CONTROL_LINE_SIZE];
+    char *output; /* answers that have not been sent yet */
+    size_t output_len, output_size;
+    struct control_client *next;
+};
+
+static void accept_handler(void *data);
+static void client_handler(void *data);
+static void close_client(struct control_client *client);
+static int flush_output(struct control_client *client);
+static void output_handler(void *data);
+
+static int listen_fd = -1;
+static char *socket_path = NULL;
+static control_handler command_handler = NULL;
+static struct control_client *clients = NULL;
+static int nclients = 0;
+
+
+void accept_handler(void *data) {
+    int fd;
+    struct control_client *client;
+
+    (void) data;
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (nclients >= CONTROL_MAX_CLIENTS) {
+            DBGPRINT("%s\n", "Too many control clients");
+            close(fd);
+            continue;
+        }
+
+        client = calloc(1, sizeof(struct control_client));
+        if (!client)
+            die("Unable to allocate memory for control client");
+        client->fd = fd;
+        if (!events_add(fd, &client_handler, client)) {
+            close(fd);
+            free(client);
+            continue;
+        }
+        client->next = clients;
+        clients = client;
+        nclients++;
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        DBGPRINT("Unable to accept control client: %s\n", strerror(errno));
+}
+
+void client_handler(void *data) {
+    ssize_t n;
+    char *end;
+    size_t linelen;
+    struct control_client *client = (struct control_client *) data;
+
+    n = read(client->fd, client->buffer + client->len, sizeof(client->buffer) - client->len - 1);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if (n <= 0) {
+        close_client(client);
+        return;
+    }
+    client->len += (size_t) n;
+    client->buffer[client->len] = '\0';
+
+    /* a single read might contain several commands */
+    while ((end = strchr(client->buffer, '\n')) != NULL) {
+        *end = '\0';
+        linelen = (size_t) (end - client->buffer) + 1;
+        if (end > client->buffer && end[-1] == '\r')
+            end[-1] = '\0';
+
+        command_handler(client, client->buffer);
+        if (client->failed) {
+            close_client(client);
+            return;
+        }
+
+        client->len -= linelen;
+        memmove(client->buffer, client->buffer + linelen, client->len + 1);
+    }
+
+    if (client->len >= sizeof(client->buffer) - 1) {
+        control_reply(client, "ERROR line too long\n");
+        flush_output(client);
+        close_client(client);
+        return;
+    }
+
+    /* the answers to all commands of this read are sent at once */
+    if (!flush_output(client))
+        close_client(client);
+}
+
+void close_client(struct control_client *client) {
+    struct control_client **link;
+
+    for (link = &clients; *link && *link != client; link = &(*link)->next);
+    if (*link)
+        *link = client->next;
+    nclients--;
+
+    events_remove(client->fd);
+    close(client->fd);
+    free(client->output);
+    free(client);
+}
+
+void control_free(void) {
+    while (clients)
+        close_client(clients);
+
+    if (listen_fd >= 0) {
+        events_remove(listen_fd);
+        close(listen_fd);
+    }
+    if (socket_path)
+        unlink(socket_path);
+    free(socket_path);
+    listen_fd = -1;
+    socket_path = NULL;
+}
+
+int control_init(control_handler handler) {
+    int fd;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (listen_fd >= 0)
+        return listen_fd;
+
+    socket_path = user_runtime_path(CONTROL_SOCKET_NAME);
+    if (!socket_path || strlen(socket_path) >= sizeof(addr.sun_path)) {
+        DBGPRINT("%s\n", "No runtime dir for the control socket");
+        free(socket_path);
+        socket_path = NULL;
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    /* do not steal the socket of a daemon that is still running */
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+        if (fprintf(stderr, "WARNING: Control socket '%s' is already in use\n", socket_path) < 0)
+            DBGPRINT("%s\n", "Unable to print to stderr");
+        close(fd);
+        free(socket_path);
+        socket_path = NULL;
+        return -1;
+    }
+    if (fd >= 0)
+        close(fd);
+    unlink(socket_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1
+            || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+            || listen(listen_fd, CONTROL_BACKLOG) == -1
+            || !events_add(listen_fd, &accept_handler, NULL)) {
+        DBGPRINT("Unable to create control socket: %s\n", strerror(errno));
+        control_free();
+        return -1;
+    }
+
+    command_handler = handler;
+    return listen_fd;
+}
+
+int control_reply(struct control_client *client, const char *format, ...) {
+    int len;
+    char buffer[CONTROL_LINE_SIZE * 2];
+    va_list args;
+
+    if (client->failed)
+        return 0;
+
+    va_start(args, format);
+    len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (len < 0)
+        return 0;
+    if ((size_t) len >= sizeof(buffer))
+        len = (int) sizeof(buffer) - 1;
+
+    /* answers are queued until the handler returns, clients that do not read them are dropped */
+    if (client->output_len + (size_t) len > CONTROL_MAX_OUTPUT
+            && (!flush_output(client) || client->output_len + (size_t) len > CONTROL_MAX_OUTPUT)) {
+        DBGPRINT("%s\n", "Unable to send answer to control client");
+        client->failed = 1;
+        return 0;
+    }
+    if (client->output_len + (size_t) len > client->output_size) {
+        client->output_size = client->output_size ? client->output_size * 2 : sizeof(buffer);
+        if (client->output_size < client->output_len + (size_t) len)
+            client->output_size = client->output_len + (size_t) len;
+        client->output = realloc(client->output, client->output_size);
+        if (!client->output)
+            die("Unable to allocate memory for control answer");
+    }
+    memcpy(client->output + client->output_len, buffer, (size_t) len);
+    client->output_len += (size_t) len;
+    return 1;
+}
+
+int control_request(const char *command, char *answer, size_t size) {
+    int fd, status = -1;
+    size_t len = 0;
+    ssize_t n;
+    char *path, *line;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct timeval timeout = { .tv_sec = CONTROL_TIMEOUT / 1000, .tv_usec = (CONTROL_TIMEOUT % 1000) * 1000 };
+
+    if (!command || !answer || size < 2)
+        return -1;
+    answer[0] = '\0';
+
+    path = user_runtime_path(CONTROL_SOCKET_NAME);
+    if (!path || strlen(path) >= sizeof(addr.sun_path)) {
+        free(path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    free(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    /* the daemon is running, so from now on errors are reported instead of falling back */
+    status = 0;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1
+            || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1
+            || send(fd, command, strlen(command), MSG_NOSIGNAL) != (ssize_t) strlen(command)
+            || send(fd, "\n", 1, MSG_NOSIGNAL) != 1) {
+        close(fd);
+        return status;
+    }
+
+    while (len < size - 1 && (n = read(fd, answer + len, size - len - 1)) > 0) {
+        len += (size_t) n;
+        answer[len] = '\0';
+        if (answer[len - 1] != '\n')
+            continue;
+
+        /* the last line is either OK or an error */
+        answer[len - 1] = '\0';
+        line = strrchr(answer, '\n');
+        line = line ? line + 1 : answer;
+        answer[len - 1] = '\n';
+        if (strcmp(line, "OK\n") == 0) {
+            status = 1;
+            break;
+        }
+        if (STR_STARTS_WITH(line, "ERROR"))
+            break;
+    }
+
+    close(fd);
+    return status;
+}
+
+int flush_output(struct control_client *client) {
+    ssize_t n;
+    size_t sent = 0;
+
+    while (sent < client->output_len) {
+        n = send(client->fd, client->output + sent, client->output_len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+            return 0;
+        sent += (size_t) n;
+    }
+    client->output_len -= sent;
+    memmove(client->output, client->output + sent, client->output_len);
+
+    /* the socket is only watched for output while something is queued */
+    return events_set_output(client->fd, client->output_len > 0 ? &output_handler : NULL);
+}
+
+void output_handler(void *data) {
+    struct control_client *client = (struct control_client *) data;
+
+    if (!flush_output(client))
+        close_client(client);
+}
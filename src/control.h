@@ -0,0 +1,41 @@
+#ifndef H_CONTROL
+#define H_CONTROL
+
+#include <stddef.h>
+
+#define CONTROL_SOCKET_NAME     "control"
+#define CONTROL_LINE_SIZE       256
+#define CONTROL_MAX_CLIENTS     16
+#define CONTROL_BACKLOG         8
+#define CONTROL_TIMEOUT         5000 /* milliseconds a client waits for an answer */
+#define CONTROL_MAX_OUTPUT      65536 /* bytes of answers queued for a client that does not read them */
+
+struct control_client;
+
+typedef void (*control_handler)(struct control_client *client, char *line);
+
+/*
+ * line based control socket at $XDG_RUNTIME_DIR/pademelon/control
+ *
+ * the socket and its clients are watched by the event loop (see events.h), every received line is
+ * passed to handler without the line break, which answers with control_reply()
+ * returns the listening socket or -1 on error (e.g. if another daemon owns the socket)
+ */
+int control_init(control_handler handler);
+void control_free(void);
+/*
+ * send a formatted answer
+ *
+ * answers are queued and sent once the handler has returned, or whenever the socket becomes writable
+ * the client is disconnected after the handler returns if this fails (e.g. if the queue is full)
+ */
+int control_reply(struct control_client *client, const char *format, ...);
+/*
+ * send a single command to the running daemon (client side)
+ *
+ * answer receives the reply including the final line (truncated to size)
+ * returns 1 on OK, 0 on ERROR or timeout and -1 if no daemon is reachable
+ */
+int control_request(const char *command, char *answer, size_t size);
+
+#endif /* H_CONTROL */
@@ -7,6 +7,7 @@
 #include <fcntl.h>
 #include <ini.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,8 +20,21 @@
 #define TEST_TIMEOUT                5   /* in seconds */
 #define PREFERENCE_NONE             "none"
 
+extern char **environ;
+
 static inline int IS_TRUE(const char *s)       { return strcmp(s, "True") == 0 || strcmp(s, "true") == 0 || strcmp(s, "1") == 0; }
 
+static char **notify_environment(void);
+
+static char *notify_socket = NULL; /* "NOTIFY_SOCKET=<address>", NULL if readiness is not tracked */
+
+static const char *restart_policies[] = {
+    [RestartUnset] = NULL,
+    [RestartNever] = "never",
+    [RestartOnFailure] = "on-failure",
+    [RestartAlways] = "always",
+};
+
 static struct dcategory categories[] = {
     /* CONFIG_SECTION_DAEMONS */
     { .name = "window-manager",     .xdg_name = "X11WindowManager", .section = CONFIG_SECTION_DAEMONS, .fallback = 1 },
@@ -43,6 +57,47 @@ static struct dcategory categories[] = {
     { .name = NULL },
 };
 
+struct dapplication *copy_application(const struct dapplication *a) {
+    size_t i, len, size;
+    char *arena;
+    struct dapplication *copy;
+
+    if (!a)
+        return NULL;
+
+    /* pack the struct and all of its strings into one allocation */
+    const char *values[] = {
+        a->display_name, a->id_name, a->desc, a->launch_cmd,
+        a->test_cmd, a->try_exec, a->settings, a->after, a->path,
+    };
+    size = sizeof(struct dapplication);
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+        if (values[i])
+            size += strlen(values[i]) + 1;
+
+    copy = malloc(size);
+    if (!copy)
+        die("Unable to allocate memory for application");
+    *copy = *a;
+    copy->next_optional = NULL;
+    copy->lazy_strings = NULL;
+    arena = (char *) (copy + 1);
+
+    char **fields[] = {
+        &copy->display_name, &copy->id_name, &copy->desc, &copy->launch_cmd,
+        &copy->test_cmd, &copy->try_exec, &copy->settings, &copy->after, &copy->path,
+    };
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (!*fields[i])
+            continue;
+        len = strlen(*fields[i]) + 1;
+        memcpy(arena, *fields[i], len);
+        *fields[i] = arena;
+        arena += len;
+    }
+    return copy;
+}
+
 int export_application(struct dapplication *application, const char *name) {
     if ((!getenv(name))
             || (application->category && application->category->exported)) {
@@ -67,72 +122,126 @@ struct dcategory *find_category(const char *name) {
     return NULL;
 }
 
+struct dcategory *find_owning_category(struct dapplication *a) {
+    struct dcategory *c;
+    struct dapplication *b;
+
+    for (c = categories; c->name; c++)
+        for (b = c->active_application; b; b = b->next_optional)
+            if (b == a)
+                return c;
+    return a->category;
+}
+
 void free_application(struct dapplication *a) {
     if (!a)
         return;
 
-    free(a->display_name);
-    free(a->id_name);
-    free(a->desc);
+    /* strings are stored in the same allocation */
+    free(a->lazy_strings);
+    free(a);
+}
 
-    free(a->launch_cmd);
-    free(a->test_cmd);
-    free(a->settings);
+void free_applications(struct dapplication *a) {
+    struct dapplication *next;
 
-    free(a);
+    for (; a; a = next) {
+        next = a->next_optional;
+        free_application(a);
+    }
 }
 
 void free_categories(void) {
     int i;
     for (i = 0; categories[i].name; i++) {
         free(categories[i].user_preference);
-        free_application(categories[i].active_application);
+        free_applications(categories[i].active_application);
     }
 }
 
 void launch_application(struct dapplication *application) {
+    int status;
     pid_t pid;
-    int stderr_fd, devnull;
+    char **argv, **envp = environ, **notify_envp = NULL;
+    sigset_t sigset;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    char *shell_args[] = { "/bin/sh", "-c", NULL, NULL };
 
-    if (!application)
+    if (!application || !application->launch_cmd)
         return;
 
-    block_signal(SIGCHLD);
-    pid = fork();
+    /* the shell is only needed for commands that rely on shell syntax */
+    argv = exec_to_argv(application->launch_cmd);
+    if (!argv) {
+        DBGPRINT("Launching '%s' through a shell\n", application->id_name);
+        shell_args[2] = application->launch_cmd;
+    }
 
-    if (pid == 0) { /* child */
-        unblock_signal(SIGCHLD);
-
-        /* disable output if possible */
-        if ((stderr_fd = dup(STDERR_FILENO)) == -1) {
-            stderr_fd = STDERR_FILENO;
-            DBGPRINT("Unable to copy stderr file descriptor: %s\n", strerror(errno));
-        } else if ((devnull = open("/dev/null", O_WRONLY)) == -1) {
-            DBGPRINT("Unable to open /dev/null: %s\n", strerror(errno));
-        } else {
-            if (dup2(devnull, STDOUT_FILENO) == -1)
-                DBGPRINT("Unable to redirect stdout of child process: %s\n", strerror(errno));
-            if (dup2(devnull, STDERR_FILENO) == -1)
-                DBGPRINT("Unable to redirect stderr of child process: %s\n", strerror(errno));
-        }
+    /* children must not inherit our signal mask; output is disabled */
+    if (posix_spawnattr_init(&attr) != 0)
+        die("Unable to initialize spawn attributes");
+    if (posix_spawn_file_actions_init(&actions) != 0)
+        die("Unable to initialize spawn file actions");
+    if (sigemptyset(&sigset) == -1
+            || posix_spawnattr_setsigmask(&attr, &sigset) != 0
+            || posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK) != 0)
+        DBGPRINT("%s\n", "Unable to reset signal mask for child process");
+    if (posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0) != 0
+            || posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO) != 0)
+        DBGPRINT("%s\n", "Unable to redirect output of child process");
+
+    /* only applications that signal readiness get the socket, everything else keeps our environment */
+    if (application->notify && notify_socket)
+        envp = notify_envp = notify_environment();
 
-        char *args[] = { "/bin/sh", "-c", application->launch_cmd, NULL };
-        execvp(args[0], args);
+    block_signal(SIGCHLD);
+    if (argv)
+        status = posix_spawnp(&pid, argv[0], &actions, &attr, argv, envp);
+    else
+        status = posix_spawn(&pid, shell_args[0], &actions, &attr, shell_args, envp);
 
-        if (dup2(stderr_fd, STDERR_FILENO) == -1)
-            DBGPRINT("Unable to reset stderr of child process: %s\n", strerror(errno));
-        if (fprintf(stderr, "WARNING: Unable to launch application '%s'\n", application->launch_cmd) < 0)
-            DBGPRINT("%s\n", "Unable to print to stderr");
-        exit(EXIT_FAILURE);
-    } else if (pid > 0) { /* parent */
+    if (status == 0) {
         plist_add(pid, application);
         if (fprintf(stderr, "Launched application: %s (`%s`)\n", application->id_name, application->launch_cmd) < 0)
             DBGPRINT("%s\n", "Unable to print to stderr");
     } else {
-        /* @TODO do we really want do die here? */
-        die("Unable to fork into a new process");
+        if (fprintf(stderr, "WARNING: Unable to launch application '%s': %s\n", application->launch_cmd, strerror(status)) < 0)
+            DBGPRINT("%s\n", "Unable to print to stderr");
     }
     unblock_signal(SIGCHLD);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    free(notify_envp);
+    free(argv);
+}
+
+char **notify_environment(void) {
+    size_t i, n;
+    char **envp;
+
+    for (n = 0; environ[n]; n++);
+    envp = malloc(sizeof(char *) * (n + 2));
+    if (!envp)
+        die("Unable to allocate memory for environment");
+
+    /* a socket we have inherited ourselves is replaced */
+    for (i = 0, n = 0; environ[i]; i++)
+        if (!STR_STARTS_WITH(environ[i], "NOTIFY_SOCKET="))
+            envp[n++] = environ[i];
+    envp[n++] = notify_socket;
+    envp[n] = NULL;
+    return envp;
+}
+
+enum restartpolicy parse_restart_policy(const char *value, size_t len) {
+    size_t i;
+
+    for (i = 0; i < sizeof(restart_policies) / sizeof(restart_policies[0]); i++)
+        if (restart_policies[i] && strlen(restart_policies[i]) == len && strncmp(restart_policies[i], value, len) == 0)
+            return (enum restartpolicy) i;
+    return RestartUnset;
 }
 
 int print_application(struct dapplication *a) {
@@ -140,22 +249,39 @@ int print_application(struct dapplication *a) {
     status = printf("[%s]\t\t; %p\n", a->id_name, (void *)a);
     if (status < 0)
         return -1;
-    PRINT_PROPERTY_STR("name", a->display_name);
-    PRINT_PROPERTY_STR("description", a->desc);
+    PRINT_PROPERTY_STR("name", application_display_name(a));
+    PRINT_PROPERTY_STR("description", application_desc(a));
     if (a->category) {
         PRINT_PROPERTY_STR("category", a->category->name);
     } else {
         PRINT_PROPERTY_STR("; category", "unknown");
     }
     PRINT_PROPERTY_STR("command", a->launch_cmd);
+    PRINT_PROPERTY_STR("tryexec", a->try_exec);
     PRINT_PROPERTY_STR("test", a->test_cmd);
     PRINT_PROPERTY_BOOL("default", a->cdefault);
+    PRINT_PROPERTY_BOOL("notify", a->notify);
 
     if (fflush(stdout) == EOF)
         return -1;
     return 0;
 }
 
+const char *restart_policy_name(enum restartpolicy policy) {
+    return restart_policies[policy];
+}
+
+int same_applications(const struct dapplication *a, const struct dapplication *b) {
+    for (; a && b; a = a->next_optional, b = b->next_optional) {
+        if (strcmp(a->id_name, b->id_name) != 0)
+            return 0;
+        if ((a->launch_cmd || b->launch_cmd)
+                && (!a->launch_cmd || !b->launch_cmd || strcmp(a->launch_cmd, b->launch_cmd) != 0))
+            return 0;
+    }
+    return !a && !b;
+}
+
 struct dapplication *select_application(struct dcategory *c) {
     struct dapplication *app = NULL;
     char *xdg_category;
@@ -179,165 +305,210 @@ struct dapplication *select_application(struct dcategory *c) {
     return app;
 }
 
-void shutdown_all_daemons(void) {
-    struct plist *pl;
-    while ((pl = plist_peek())) {
-        if (kill(pl->pid, SIGTERM) == -1) {
-            plist_pop();
+struct dapplication *select_applications(struct dcategory *c) {
+    struct dapplication *a, *first = NULL, *last = NULL;
+    char *s, *token, *saveptr = NULL;
+    const char **dirs;
+
+    if (!c)
+        return NULL;
+    if (!c->optional)
+        return select_application(c);
+    if (!c->user_preference)
+        return NULL;
+
+    dirs = desktop_entry_dirs();
+    if (!dirs) {
+        DBGPRINT("unable to get desktop entry dirs");
+        return NULL;
+    }
+
+    s = strdup(c->user_preference);
+    if (!s)
+        die("Unable to allocate memory for optional daemons");
+    for (token = strtok_r(s, " ", &saveptr); token; token = strtok_r(NULL, " ", &saveptr)) {
+        DBGPRINT("Looking for application '%s'\n", token);
+        a = application_by_name(dirs, token, c->xdg_name);
+        if (!a)
             continue;
-        }
-        plist_wait(pl, 1000);
-        if (!pl->status_changed) {
-            kill(pl->pid, SIGKILL);
-        }
-        plist_pop();
+
+        a->next_optional = NULL;
+        if (last)
+            last->next_optional = a;
+        else
+            first = a;
+        last = a;
     }
+    free(s);
+    return first;
 }
 
-void shutdown_daemon(struct dcategory *c) {
-    struct plist *pl;
-    pl = plist_search(NULL, c->name);
-    if (!pl)
+void set_notify_socket(const char *address) {
+    free(notify_socket);
+    notify_socket = NULL;
+    if (!address)
         return;
 
-    if (kill(pl->pid, SIGTERM) == -1)
-        return;
-    plist_wait(pl, 1000);
-    if (!pl->status_changed) {
-        kill(pl->pid, SIGKILL);
-    }
-    plist_remove(pl->pid);
+    notify_socket = malloc(strlen("NOTIFY_SOCKET=") + strlen(address) + 1);
+    if (!notify_socket)
+        die("Unable to allocate memory for readiness socket");
+    sprintf(notify_socket, "NOTIFY_SOCKET=%s", address);
 }
 
-void shutdown_optionals(struct dcategory *c) {
-    struct plist *pl;
-    char *s, *token;
-
-    if (!c)
-        return;
+void test_abort(struct dtest *tests, int ntests) {
+    int i;
 
-    if (c->user_preference) {
-        s = strdup(c->user_preference);
-        if (!s)
-            die("Unable to allocate memory for optional daemons");
-        for(token = strtok(s, " "); token; token = strtok(NULL, " ")) {
-            pl = plist_search(token, NULL);
-            if (!pl)
-                return;
-
-            if (kill(pl->pid, SIGTERM) == -1)
-                return;
-            plist_wait(pl, 1000);
-            if (!pl->status_changed) {
-                if (kill(pl->pid, SIGKILL) == -1)
-                    return;
-            }
-        }
-        free(s);
+    for (i = 0; i < ntests; i++) {
+        if (tests[i].state != TestRunning)
+            continue;
+        kill(-tests[i].pid, SIGKILL);
+        waitpid(tests[i].pid, NULL, 0);
+        tests[i].state = TestFinished;
+        tests[i].available = 0;
     }
 }
 
-int startup_daemon(struct dcategory *c) {
-    struct dapplication *app;
-
-    if (!c)
-        return 0;
+int test_application(struct dapplication *application) {
+    int result;
 
-    app = select_application(c);
-    if (!app)
-        return 0;
+    if (!application)
+        return 1;
 
-    if (test_application(app))
-        launch_application(app);
-    c->active_application = app;
-    return 1;
+    test_applications(&application, &result, 1);
+    return result;
 }
 
-int startup_optionals(struct dcategory *c) {
-    struct dapplication *a, *b;
-    char *s, *token, *saveptr = NULL;
-    const char **dirs;
+int test_applications(struct dapplication **applications, int *results, int n) {
+    int i, navailable = 0;
+    struct dtest *tests;
 
-    if (!c)
+    if (n <= 0)
         return 0;
 
-    dirs = desktop_entry_dirs();
-    if (!dirs) {
-        DBGPRINT("unable to get desktop entry dirs");
-        return 0;
-    }
+    tests = calloc((size_t) n, sizeof(struct dtest));
+    if (!tests)
+        die("Unable to allocate memory for application tests");
 
-    c->active_application = NULL;
-    if (c->user_preference) {
-        s = strdup(c->user_preference);
-        if (!s)
-            die("Unable to allocate memory for optional daemons");
-        for(token = strtok_r(s, " ", &saveptr); token; token = strtok_r(NULL, " ", &saveptr)) {
-            DBGPRINT("Looking for application '%s'\n", token);
-            a = application_by_name(dirs, token, c->xdg_name);
-            if (a && test_application(a))
-                launch_application(a);
-
-            if (!c->active_application)
-                c->active_application = a;
-            else {
-                for (b = c->active_application; b->next_optional; b = b->next_optional);
-                a->next_optional = NULL;
-                b->next_optional = a;
-            }
-        }
-        free(s);
+    /* keep SIGCHLD pending instead of swapping out the handler */
+    block_signal(SIGCHLD);
+    for (i = 0; i < n; i++)
+        test_start(&tests[i], applications[i]);
+    while (test_wait(tests, n, -1) > 0);
+
+    /* only left over if waiting failed */
+    test_abort(tests, n);
+    unblock_signal(SIGCHLD);
+
+    for (i = 0; i < n; i++) {
+        results[i] = tests[i].available;
+        navailable += results[i];
     }
-    return 1;
+
+    free(tests);
+    return navailable;
 }
 
-int test_application(struct dapplication *application) {
-    int status, wstatus;
+int test_start(struct dtest *test, struct dapplication *application) {
     pid_t pid;
-    /* int sleep_remaining = TEST_TIMEOUT; */
 
-    if (!application || !application->test_cmd)
+    test->application = application;
+    test->pid = 0;
+    test->state = TestFinished;
+    test->available = 1;
+
+    if (!application)
         return 1;
 
-    /* @TODO handle errors */
-    install_default_sigchld_handler();
-    unblock_signal(SIGCHLD);
-    pid = fork();
+    /* TryExec does not need a shell */
+    if (application->try_exec && !executable_available(application->try_exec)) {
+        test->available = 0;
+        return 1;
+    }
+
+    /* only custom tests are run in a separate process */
+    if (!application->test_cmd)
+        return 1;
 
+    pid = fork();
     if (pid == 0) { /* child */
+        reset_signal_mask();
+        setpgid(0, 0); /* allows killing the whole test on timeout */
         char *args[] = { "/bin/sh", "-c", application->test_cmd, NULL };
         execvp(args[0], args);
-        exit(EXIT_SUCCESS); /* exec has failed */
-    } else if (pid > 0) { /* parent */
-        /* while ((status = waitpid(pid, &wstatus, WUNTRACED|WNOHANG)) == 0) { */
-        /*     sleep_remaining = sleep(sleep_remaining); */
-        /*     fprintf(stderr, "sleep interupted: %d remaining\n", sleep_remaining); */
-        /*     if (sleep_remaining == 0) */
-        /*         break; */
-        /* } */
-        status = waitpid(pid, &wstatus, WUNTRACED);
-
-        if (status == -1) { /* an error occured */
-            perror("waitpid");
-            restore_sigchld_handler();
-            return 0;
-        } else if (status == 0) {   /* child has not returned yet */
-            /* kill child */
-            kill(pid, SIGKILL);
-            restore_sigchld_handler();
-            return 0;
-        } else {    /* child has terminated and no error occured */
-            if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0) {
-                restore_sigchld_handler();
-                return 1;
-            } else {
-                restore_sigchld_handler();
-                return 0;
+        _exit(EXIT_SUCCESS); /* exec has failed, atexit handlers and stdio buffers belong to the parent */
+    } else if (pid < 0) {
+        DBGPRINT("Unable to fork test for '%s': %s\n", application->id_name, strerror(errno));
+        test->available = 0;
+        return 1;
+    }
+
+    /* set here as well, so the group exists even if the test times out before the child has run */
+    setpgid(pid, pid);
+
+    if (clock_gettime(CLOCK_MONOTONIC, &test->deadline) == -1)
+        die("Unable to read monotonic clock");
+    test->deadline.tv_sec += TEST_TIMEOUT;
+    test->pid = pid;
+    test->state = TestRunning;
+    return 0;
+}
+
+int test_wait(struct dtest *tests, int ntests, int wake_fd) {
+    int i, status, running, finished;
+    long remaining_nsec, earliest_nsec;
+    pid_t pid;
+    struct timespec now, timeout;
+
+    for (;;) {
+        /* collect all tests that have terminated */
+        finished = 0;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (i = 0; i < ntests; i++) {
+                if (tests[i].state == TestRunning && tests[i].pid == pid) {
+                    tests[i].state = TestFinished;
+                    tests[i].available = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                    finished++;
+                    break;
+                }
             }
+            /* not one of our tests, but possibly a supervised process */
+            if (i == ntests)
+                plist_set_status(pid, status);
         }
-    } else {
-        /* unable to fork into new process */
-        restore_sigchld_handler();
-        return 0;
+
+        /* kill tests that have overrun their deadline */
+        if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+            return -1;
+        running = 0;
+        earliest_nsec = -1;
+        for (i = 0; i < ntests; i++) {
+            if (tests[i].state != TestRunning)
+                continue;
+            remaining_nsec = (tests[i].deadline.tv_sec - now.tv_sec) * 1000000000L
+                + (tests[i].deadline.tv_nsec - now.tv_nsec);
+            if (remaining_nsec <= 0) {
+                if (fprintf(stderr, "WARNING: Test for application '%s' timed out\n", tests[i].application->id_name) < 0)
+                    DBGPRINT("%s\n", "Unable to print to stderr");
+                kill(-tests[i].pid, SIGKILL);
+                waitpid(tests[i].pid, NULL, 0);
+                tests[i].state = TestFinished;
+                tests[i].available = 0;
+                finished++;
+                continue;
+            }
+            if (earliest_nsec < 0 || remaining_nsec < earliest_nsec)
+                earliest_nsec = remaining_nsec;
+            running++;
+        }
+
+        if (finished > 0 || running == 0)
+            return finished;
+
+        /* sleep until a child terminates or the next deadline is reached */
+        timeout.tv_sec = earliest_nsec / 1000000000L;
+        timeout.tv_nsec = earliest_nsec % 1000000000L;
+        status = wait_sigchld(&timeout, wake_fd);
+        if (status != 0)
+            return status == 1 ? 0 : -1;
     }
 }
@@ -2,44 +2,99 @@
 #define H_DESKTOP_APPLICATION
 
 #include "pademelon-config.h"
+#include <sys/types.h>
+#include <time.h>
+
+enum dlazyfield { /* fields that are only loaded on demand by lazily parsed entries */
+    LazyDisplayName, LazyDesc, LazySettings, LAZY_FIELDS,
+};
+
+enum restartpolicy { /* X-Pademelon-Restart or the restart section of the config */
+    RestartUnset, RestartNever, RestartOnFailure, RestartAlways,
+};
+
+struct dspanoffset { /* position of a value in the desktop file */
+    off_t offset;
+    size_t len;
+};
 
 #define APPLICATION_FILE_ENDING      ".dapp"
 
-struct dapplication {
+struct dapplication { /* strings are stored in the same allocation, freed in free_application() */
     int cdefault;
-    char *display_name, *id_name, *desc; /* allocated by user, freed in free_application() */
-    char *launch_cmd, *test_cmd; /* allocated by user, freed in free_application() */
-    char *settings; /* allocated by user, freed in free_application() */
+    int hidden; /* Hidden=true, the entry only shadows others */
+    int notify; /* X-Pademelon-Notify=true, readiness is signaled through $NOTIFY_SOCKET */
+    enum restartpolicy restart;
+    char *display_name, *id_name, *desc;
+    char *launch_cmd, *test_cmd;
+    char *try_exec; /* evaluated without a shell */
+    char *settings;
+    char *after; /* categories to be started first */
     struct dapplication *next_optional;
     struct dcategory *category;
+
+    /* lazily parsed entries: fields are read from path on demand (see desktop-files.h) */
+    char *path; /* NULL once the fields are loaded */
+    off_t size;
+    struct timespec mtime;
+    struct dspanoffset lazy[LAZY_FIELDS]; /* len is 0 if the field is not present */
+    char *lazy_strings; /* loaded fields, freed in free_application() */
+};
+
+enum dteststate {
+    TestIdle, TestRunning, TestFinished,
+};
+
+struct dtest { /* availability test running in the background */
+    enum dteststate state;
+    int available;
+    pid_t pid;
+    struct timespec deadline;
+    struct dapplication *application;
 };
 
 struct dcategory { /* linked list with applications in category */
     int exported; /* runtime variables */
     const int fallback, optional; /* configuration variables */
+    enum restartpolicy restart;
     char *name, *xdg_name, *section, *user_preference;
     struct dapplication *active_application;
     /* @TODO free user_preference */
 };
 
+/* returns a copy of a in a single allocation (next_optional is not copied) */
+struct dapplication *copy_application(const struct dapplication *a);
 int export_application(struct dapplication *application, const char *name);
 struct dapplication *find_application(const char *id_name, const char *category, int init_if_not_found);
 struct dcategory *find_category(const char *name);
+/* returns the category a was started for (optional daemons do not necessarily share it) */
+struct dcategory *find_owning_category(struct dapplication *a);
 void free_application(struct dapplication *a);
+/* frees a and all applications linked by next_optional */
+void free_applications(struct dapplication *a);
 void free_categories(void);
 struct dcategory *get_categories(void);
+/* returns RestartUnset for unknown values */
+enum restartpolicy parse_restart_policy(const char *value, size_t len);
 int ini_application_callback(void* user, const char* section, const char* name, const char* value);
 void init_sigset_sigchld(void);
 void launch_application(struct dapplication *application);
 int print_application(struct dapplication *a);
 int print_applications(void);
+const char *restart_policy_name(enum restartpolicy policy);
+/* returns 1 if both lists of applications have the same ids and Exec values in the same order */
+int same_applications(const struct dapplication *a, const struct dapplication *b);
 struct dapplication *select_application(struct dcategory *c);
-void shutdown_all_daemons(void);
-void shutdown_daemon(struct dcategory *c);
-void shutdown_optionals(struct dcategory *c);
-int startup_daemon(struct dcategory *c);
-int startup_optionals(struct dcategory *c);
+/* returns all configured applications for optional categories (linked by next_optional) */
+struct dapplication *select_applications(struct dcategory *c);
+/* address passed as $NOTIFY_SOCKET to applications with notify set, NULL to stop passing it */
+void set_notify_socket(const char *address);
+/* kill and reap all running tests, which are marked as finished and unavailable */
+void test_abort(struct dtest *tests, int ntests);
 int test_application(struct dapplication *application);
+int test_applications(struct dapplication **applications, int *results, int n);
+int test_start(struct dtest *test, struct dapplication *application);
+int test_wait(struct dtest *tests, int ntests, int wake_fd);
 
 
 static const struct dapplication application_default = { /* do NOT define strings here (invalid free) */
@@ -0,0 +1,551 @@
+#include "common.h"
+#include "desktop-application.h"
+#include "desktop-cache.h"
+#include "desktop-files.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DCACHE_MAGIC            "PDMLNIDX"
+#define DCACHE_VERSION          4
+#define DCACHE_NULL             UINT32_MAX
+#define DESKTOP_FILE_ENDING     ".desktop"
+
+static inline size_t ALIGN8(size_t n) { return (n + 7) & ~((size_t) 7); }
+
+/*
+ * file layout (native byte order, all offsets relative to the start of the file):
+ *
+ *   header | dirs[ndirs] | entries[nentries] | by_id[nentries] | by_category[nentries] | strings
+ *
+ * entries are stored in scan order (dirs in order of priority, then directory order)
+ * only the first entry of each id is stored, hidden ones are kept to shadow the others
+ * by_id and by_category are indices into entries, sorted by the respective string and scan order
+ * string fields are offsets into the string table or DCACHE_NULL
+ */
+struct dcache_header {
+    char magic[8];
+    uint32_t version, size;
+    uint32_t ndirs, nentries;
+    uint32_t dirs, entries, by_id, by_category, strings, strings_size;
+};
+
+struct dcache_dir {
+    int64_t mtime_sec, mtime_nsec;
+    uint32_t path, exists;
+};
+
+struct dcache_entry {
+    uint32_t dir, hidden, restart, notify;
+    uint32_t id, category, display_name, desc, launch_cmd, try_exec, test_cmd, settings, after;
+};
+
+struct dcache_builder {
+    char *strings;
+    size_t strings_len, strings_cap;
+    struct dcache_entry *entries;
+    size_t nentries, entries_cap;
+};
+
+static uint32_t add_string(struct dcache_builder *b, const char *s);
+static int build(const char **dirs, const char *path);
+static int build_dir(struct dcache_builder *b, const char *dir, uint32_t dir_index);
+static int compare_by_category(const void *a, const void *b);
+static int compare_by_id(const void *a, const void *b);
+static int compare_strings(uint32_t a, uint32_t b);
+static const struct dcache_entry *entry_at(const uint32_t *index, uint32_t i);
+static struct dapplication *materialize(const struct dcache_entry *e);
+static int mkdir_parents(const char *path);
+static void resolve_shadowing(struct dcache_builder *b);
+static int open_cache(const char **dirs);
+static int map_file(const char *path);
+static const char *string_at(uint32_t offset);
+static void unmap(void);
+static int valid(const char **dirs);
+static int valid_indices(void);
+
+static const char *sort_strings = NULL;
+static const struct dcache_entry *sort_entries = NULL;
+
+static const struct dcache_header *header = NULL;
+static size_t header_size = 0;
+
+
+uint32_t add_string(struct dcache_builder *b, const char *s) {
+    size_t len, offset;
+    char *temp;
+
+    if (!s)
+        return DCACHE_NULL;
+
+    len = strlen(s) + 1;
+    if (b->strings_len + len > b->strings_cap) {
+        b->strings_cap = (b->strings_cap + len) * 2;
+        temp = realloc(b->strings, b->strings_cap);
+        if (!temp)
+            die("Unable to allocate memory for desktop entry cache");
+        b->strings = temp;
+    }
+
+    offset = b->strings_len;
+    memcpy(&b->strings[offset], s, len);
+    b->strings_len += len;
+    return (uint32_t) offset;
+}
+
+int build(const char **dirs, const char *path) {
+    int fd, status = 0;
+    char *temppath = NULL;
+    uint32_t i, ndirs, *by_id = NULL, *by_category = NULL;
+    size_t offset;
+    struct stat dirstats;
+    struct dcache_header h = {0};
+    struct dcache_dir *cdirs;
+    struct dcache_builder b = {0};
+
+    for (ndirs = 0; dirs[ndirs]; ndirs++);
+    cdirs = calloc(ndirs ? ndirs : 1, sizeof(struct dcache_dir));
+    if (!cdirs)
+        return 0;
+
+    /* take the timestamps first, so changes during the scan invalidate the new cache */
+    for (i = 0; i < ndirs; i++) {
+        cdirs[i].path = add_string(&b, dirs[i]);
+        if (stat(dirs[i], &dirstats) == 0) {
+            cdirs[i].exists = 1;
+            cdirs[i].mtime_sec = (int64_t) dirstats.st_mtim.tv_sec;
+            cdirs[i].mtime_nsec = (int64_t) dirstats.st_mtim.tv_nsec;
+        }
+    }
+    for (i = 0; i < ndirs; i++)
+        if (cdirs[i].exists)
+            build_dir(&b, dirs[i], i);
+    resolve_shadowing(&b);
+
+    /* create lookup tables */
+    by_id = malloc(sizeof(uint32_t) * (b.nentries ? b.nentries : 1));
+    by_category = malloc(sizeof(uint32_t) * (b.nentries ? b.nentries : 1));
+    if (!by_id || !by_category)
+        goto cleanup;
+    for (i = 0; i < b.nentries; i++)
+        by_id[i] = by_category[i] = i;
+    sort_strings = b.strings;
+    sort_entries = b.entries;
+    qsort(by_id, b.nentries, sizeof(uint32_t), compare_by_id);
+    qsort(by_category, b.nentries, sizeof(uint32_t), compare_by_category);
+
+    /* lay out file */
+    memcpy(h.magic, DCACHE_MAGIC, sizeof(h.magic));
+    h.version = DCACHE_VERSION;
+    h.ndirs = ndirs;
+    h.nentries = (uint32_t) b.nentries;
+    offset = ALIGN8(sizeof(struct dcache_header));
+    h.dirs = (uint32_t) offset;
+    offset = ALIGN8(offset + sizeof(struct dcache_dir) * ndirs);
+    h.entries = (uint32_t) offset;
+    offset = ALIGN8(offset + sizeof(struct dcache_entry) * b.nentries);
+    h.by_id = (uint32_t) offset;
+    offset = ALIGN8(offset + sizeof(uint32_t) * b.nentries);
+    h.by_category = (uint32_t) offset;
+    offset = ALIGN8(offset + sizeof(uint32_t) * b.nentries);
+    h.strings = (uint32_t) offset;
+    h.strings_size = (uint32_t) b.strings_len;
+    offset += b.strings_len;
+    if (offset > UINT32_MAX)
+        goto cleanup;
+    h.size = (uint32_t) offset;
+
+    /* write to temporary file and move it into place atomically */
+    if (!mkdir_parents(path))
+        goto cleanup;
+    temppath = malloc(strlen(path) + strlen(".XXXXXX") + 1);
+    if (!temppath)
+        goto cleanup;
+    sprintf(temppath, "%s.XXXXXX", path);
+    fd = mkstemp(temppath);
+    if (fd == -1)
+        goto cleanup;
+
+    status = pwrite(fd, &h, sizeof(h), 0) == sizeof(h)
+        && pwrite(fd, cdirs, sizeof(struct dcache_dir) * ndirs, h.dirs)
+                == (ssize_t) (sizeof(struct dcache_dir) * ndirs)
+        && pwrite(fd, b.entries, sizeof(struct dcache_entry) * b.nentries, h.entries)
+                == (ssize_t) (sizeof(struct dcache_entry) * b.nentries)
+        && pwrite(fd, by_id, sizeof(uint32_t) * b.nentries, h.by_id)
+                == (ssize_t) (sizeof(uint32_t) * b.nentries)
+        && pwrite(fd, by_category, sizeof(uint32_t) * b.nentries, h.by_category)
+                == (ssize_t) (sizeof(uint32_t) * b.nentries)
+        && pwrite(fd, b.strings, b.strings_len, h.strings) == (ssize_t) b.strings_len;
+    if (close(fd) == -1)
+        status = 0;
+    if (status && rename(temppath, path) == -1)
+        status = 0;
+    if (!status) {
+        DBGPRINT("Unable to write desktop entry cache '%s': %s\n", path, strerror(errno));
+        unlink(temppath);
+    }
+
+cleanup:
+    free(temppath);
+    free(by_id);
+    free(by_category);
+    free(cdirs);
+    free(b.entries);
+    free(b.strings);
+    return status;
+}
+
+int build_dir(struct dcache_builder *b, const char *dir, uint32_t dir_index) {
+    DIR *directory;
+    struct dirent *diriter;
+    struct stat filestats;
+    struct dapplication *app;
+    struct dcache_entry *e, *temp;
+
+    directory = opendir(dir);
+    if (!directory)
+        return 0;
+
+    while ((diriter = readdir(directory)) != NULL) {
+        if (!STR_ENDS_WITH(diriter->d_name, DESKTOP_FILE_ENDING))
+            continue;
+
+        char subpath[strlen(dir) + strlen("/") + strlen(diriter->d_name) + 1];
+        snprintf(subpath, sizeof(subpath), "%s/%s", dir, diriter->d_name);
+        if (stat(subpath, &filestats) != 0 || !S_ISREG(filestats.st_mode))
+            continue;
+
+        app = parse_desktop_file(subpath, diriter->d_name, 0);
+        if (!app)
+            continue;
+
+        if (b->nentries == b->entries_cap) {
+            b->entries_cap = b->entries_cap ? b->entries_cap * 2 : 32;
+            temp = realloc(b->entries, sizeof(struct dcache_entry) * b->entries_cap);
+            if (!temp)
+                die("Unable to allocate memory for desktop entry cache");
+            b->entries = temp;
+        }
+        e = &b->entries[b->nentries++];
+        e->dir = dir_index;
+        e->hidden = (uint32_t) app->hidden;
+        e->restart = (uint32_t) app->restart;
+        e->notify = (uint32_t) app->notify;
+        e->id = add_string(b, app->id_name);
+        e->category = add_string(b, app->category ? app->category->xdg_name : NULL);
+        e->display_name = add_string(b, app->display_name);
+        e->desc = add_string(b, app->desc);
+        e->launch_cmd = add_string(b, app->launch_cmd);
+        e->try_exec = add_string(b, app->try_exec);
+        e->test_cmd = add_string(b, app->test_cmd);
+        e->settings = add_string(b, app->settings);
+        e->after = add_string(b, app->after);
+        free_application(app);
+    }
+
+    closedir(directory);
+    return 1;
+}
+
+int compare_by_category(const void *a, const void *b) {
+    uint32_t ia = *(const uint32_t *) a, ib = *(const uint32_t *) b;
+    int status = compare_strings(sort_entries[ia].category, sort_entries[ib].category);
+    return status ? status : (ia > ib) - (ia < ib);
+}
+
+int compare_by_id(const void *a, const void *b) {
+    uint32_t ia = *(const uint32_t *) a, ib = *(const uint32_t *) b;
+    int status = compare_strings(sort_entries[ia].id, sort_entries[ib].id);
+    return status ? status : (ia > ib) - (ia < ib);
+}
+
+int compare_strings(uint32_t a, uint32_t b) {
+    /* missing strings are sorted last */
+    if (a == DCACHE_NULL || b == DCACHE_NULL)
+        return (a == DCACHE_NULL) - (b == DCACHE_NULL);
+    return strcmp(&sort_strings[a], &sort_strings[b]);
+}
+
+int dcache_application_by_category(const char **dirs, const char *category, struct dapplication **app) {
+    uint32_t low, high, mid;
+    const char *s;
+    const uint32_t *by_category;
+
+    *app = NULL;
+    if (!dirs || !category || !open_cache(dirs))
+        return 0;
+
+    /* find the first entry (in scan order) of the category */
+    by_category = (const uint32_t *) ((const char *) header + header->by_category);
+    low = 0;
+    high = header->nentries;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        s = string_at(entry_at(by_category, mid)->category);
+        if (s && strcmp(s, category) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    for (; low < header->nentries; low++) {
+        s = string_at(entry_at(by_category, low)->category);
+        if (!s || strcmp(s, category) != 0)
+            break;
+        if (!entry_at(by_category, low)->hidden) {
+            *app = materialize(entry_at(by_category, low));
+            break;
+        }
+    }
+    return 1;
+}
+
+int dcache_application_by_name(const char **dirs, const char *name, const char *expected_category,
+        struct dapplication **app) {
+    uint32_t low, high, mid;
+    const char *s;
+    const uint32_t *by_id;
+    const struct dcache_entry *e;
+
+    *app = NULL;
+    if (!dirs || !name || !open_cache(dirs))
+        return 0;
+
+    by_id = (const uint32_t *) ((const char *) header + header->by_id);
+    low = 0;
+    high = header->nentries;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        s = string_at(entry_at(by_id, mid)->id);
+        if (s && strcmp(s, name) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    /* ids are unique, shadowed entries are not stored */
+    if (low == header->nentries)
+        return 1;
+    e = entry_at(by_id, low);
+    s = string_at(e->id);
+    if (!s || strcmp(s, name) != 0 || e->hidden)
+        return 1;
+    if (expected_category) {
+        s = string_at(e->category);
+        if (!s || strcmp(s, expected_category) != 0)
+            return 1;
+    }
+    *app = materialize(e);
+    return 1;
+}
+
+void dcache_close(void) {
+    unmap();
+}
+
+const struct dcache_entry *entry_at(const uint32_t *index, uint32_t i) {
+    const struct dcache_entry *entries = (const struct dcache_entry *) ((const char *) header + header->entries);
+    return &entries[index[i]];
+}
+
+struct dapplication *materialize(const struct dcache_entry *e) {
+    const char *category;
+    struct dapplication app = {0};
+
+    /* point into the mapping, copy_application() packs everything into one allocation */
+    app.id_name = (char *) string_at(e->id);
+    app.display_name = (char *) string_at(e->display_name);
+    app.desc = (char *) string_at(e->desc);
+    app.launch_cmd = (char *) string_at(e->launch_cmd);
+    app.try_exec = (char *) string_at(e->try_exec);
+    app.test_cmd = (char *) string_at(e->test_cmd);
+    app.settings = (char *) string_at(e->settings);
+    app.after = (char *) string_at(e->after);
+    app.restart = (enum restartpolicy) e->restart;
+    app.notify = (int) e->notify;
+
+    category = string_at(e->category);
+    if (category)
+        app.category = find_category(category);
+    return copy_application(&app);
+}
+
+int mkdir_parents(const char *path) {
+    char *p, *s;
+
+    s = strdup(path);
+    if (!s)
+        return 0;
+
+    /* create every parent directory of path */
+    for (p = strchr(s + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(s, S_IRWXU) == -1 && errno != EEXIST) {
+            free(s);
+            return 0;
+        }
+        *p = '/';
+    }
+    free(s);
+    return 1;
+}
+
+int map_file(const char *path) {
+    int fd;
+    void *m;
+    struct stat filestats;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 0;
+    if (fstat(fd, &filestats) == -1 || filestats.st_size < (off_t) sizeof(struct dcache_header)) {
+        close(fd);
+        return 0;
+    }
+
+    m = mmap(NULL, (size_t) filestats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+        return 0;
+
+    header = (const struct dcache_header *) m;
+    header_size = (size_t) filestats.st_size;
+
+    /* lookup tables must only point to existing entries */
+    if (!valid_indices()) {
+        unmap();
+        return 0;
+    }
+    return 1;
+}
+
+int open_cache(const char **dirs) {
+    int status;
+    char *path;
+
+    if (header && valid(dirs))
+        return 1;
+    unmap();
+
+    path = user_cache_path(DESKTOP_CACHE_FILE);
+    if (!path)
+        return 0;
+
+    /* use existing cache or rebuild it */
+    status = map_file(path) && valid(dirs);
+    if (!status) {
+        unmap();
+        DBGPRINT("Rebuilding desktop entry cache '%s'\n", path);
+        status = build(dirs, path) && map_file(path) && valid(dirs);
+        if (!status)
+            unmap();
+    }
+
+    free(path);
+    return status;
+}
+
+void resolve_shadowing(struct dcache_builder *b) {
+    size_t i, n;
+    uint32_t *order;
+    char *keep;
+
+    if (b->nentries == 0)
+        return;
+
+    /* sort by id and scan order, so the first entry of every id is the one with the highest priority */
+    order = malloc(sizeof(uint32_t) * b->nentries);
+    keep = malloc(b->nentries);
+    if (!order || !keep)
+        die("Unable to allocate memory for desktop entry cache");
+    for (i = 0; i < b->nentries; i++)
+        order[i] = (uint32_t) i;
+    sort_strings = b->strings;
+    sort_entries = b->entries;
+    qsort(order, b->nentries, sizeof(uint32_t), compare_by_id);
+    for (i = 0; i < b->nentries; i++)
+        keep[order[i]] = i == 0 || compare_strings(b->entries[order[i]].id, b->entries[order[i - 1]].id) != 0;
+
+    /* drop shadowed entries, but keep the scan order */
+    for (i = 0, n = 0; i < b->nentries; i++)
+        if (keep[i])
+            b->entries[n++] = b->entries[i];
+    b->nentries = n;
+
+    free(order);
+    free(keep);
+}
+
+const char *string_at(uint32_t offset) {
+    if (offset == DCACHE_NULL || offset >= header->strings_size)
+        return NULL;
+    return (const char *) header + header->strings + offset;
+}
+
+void unmap(void) {
+    if (header)
+        munmap((void *) header, header_size);
+    header = NULL;
+    header_size = 0;
+}
+
+int valid(const char **dirs) {
+    uint32_t i;
+    const char *s;
+    const struct dcache_dir *cdirs;
+    struct stat dirstats;
+
+    /* check file layout */
+    if (memcmp(header->magic, DCACHE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != DCACHE_VERSION
+            || header->size != header_size
+            || header->dirs + sizeof(struct dcache_dir) * header->ndirs > header_size
+            || header->entries + sizeof(struct dcache_entry) * header->nentries > header_size
+            || header->by_id + sizeof(uint32_t) * header->nentries > header_size
+            || header->by_category + sizeof(uint32_t) * header->nentries > header_size
+            || (size_t) header->strings + header->strings_size > header_size
+            || (header->strings_size > 0 && ((const char *) header)[header->strings + header->strings_size - 1] != '\0'))
+        return 0;
+
+    /* check if the directories are still the same */
+    cdirs = (const struct dcache_dir *) ((const char *) header + header->dirs);
+    for (i = 0; dirs[i]; i++) {
+        if (i >= header->ndirs)
+            return 0;
+        s = string_at(cdirs[i].path);
+        if (!s || strcmp(s, dirs[i]) != 0)
+            return 0;
+        if (stat(dirs[i], &dirstats) != 0) {
+            if (cdirs[i].exists)
+                return 0;
+        } else if (!cdirs[i].exists
+                || cdirs[i].mtime_sec != (int64_t) dirstats.st_mtim.tv_sec
+                || cdirs[i].mtime_nsec != (int64_t) dirstats.st_mtim.tv_nsec) {
+            return 0;
+        }
+    }
+    return i == header->ndirs;
+}
+
+int valid_indices(void) {
+    uint32_t i;
+    const uint32_t *by_id, *by_category;
+
+    if (header->by_id + sizeof(uint32_t) * header->nentries > header_size
+            || header->by_category + sizeof(uint32_t) * header->nentries > header_size)
+        return 0;
+
+    by_id = (const uint32_t *) ((const char *) header + header->by_id);
+    by_category = (const uint32_t *) ((const char *) header + header->by_category);
+    for (i = 0; i < header->nentries; i++)
+        if (by_id[i] >= header->nentries || by_category[i] >= header->nentries)
+            return 0;
+    return 1;
+}
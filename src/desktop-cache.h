@@ -0,0 +1,18 @@
+#ifndef H_DESKTOP_CACHE
+#define H_DESKTOP_CACHE
+
+#define DESKTOP_CACHE_FILE      "desktop-entries.cache"
+
+/*
+ * look up desktop entries in the persistent index in $XDG_CACHE_HOME/pademelon
+ *
+ * the index is validated against the modification times of the given dirs and rebuilt if
+ * one of them has changed
+ * returns 0 if the index is not usable, 1 otherwise (*app is set to NULL if no entry was found)
+ */
+int dcache_application_by_category(const char **dirs, const char *category, struct dapplication **app);
+int dcache_application_by_name(const char **dirs, const char *name, const char *expected_category,
+        struct dapplication **app);
+void dcache_close(void);
+
+#endif /* H_DESKTOP_CACHE */
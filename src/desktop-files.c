@@ -1,81 +1,313 @@
 #include "common.h"
 #include "desktop-application.h"
+#include "desktop-cache.h"
 #include "desktop-files.h"
+#include "desktop-index.h"
 #include <dirent.h>
-#include <ini.h>
+#include <fcntl.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <unistd.h>
 
 #define DESKTOP_FILE_ENDING     ".desktop"
+#define DEFAULT_PATH            "/usr/local/bin:/usr/bin:/bin"
+#define EXEC_RESERVED_CHARS     "\t\n'\\><~|&;$*?#()`"
+#define EXEC_QUOTED_ESCAPES     "\"`$\\"
+#define EXEC_FIELD_CODES        "fFuUdDnNickvm"
+#define DESKTOP_ENTRY_GROUP     "[Desktop Entry]"
+#define DESKTOP_KEYS_SIZE       16 /* power of two */
+
+/* perfect hash for all keys in desktop_keys (verified by desktop_key()) */
+static inline unsigned int DESKTOP_KEY_HASH(const char *k, size_t len) { return (unsigned int) (len * 2 + (unsigned char) k[0]) & (DESKTOP_KEYS_SIZE - 1); }
 
 struct cmapping {
     char *xdg_name, *internal_name;
 };
 
+enum dkeytype {
+    KeyUnknown, KeyString, KeyLazyString, KeyHidden, KeyCategories, KeyRestart, KeyNotify,
+};
+
+struct dkey {
+    const char *name;
+    enum dkeytype type;
+    size_t field; /* offset of the string field in struct dapplication */
+    enum dlazyfield lazy; /* only for KeyLazyString */
+};
+
+struct dspan { /* value inside of the mapped file */
+    const char *start;
+    size_t len;
+};
 
-static int desktop_file_callback(void* user, const char* section, const char* name, const char* value);
-static struct dcategory *parse_categories(const char *string);
+struct executable_cache_entry {
+    char *name;
+    int available;
+};
 
 
-const char **desktop_entry_dirs(void) {
-    /* @TODO add user and xdg directories */
-    static const char *dirs[] = {
-        NULL,
-        "/usr/local/share/pademelon/applications",
-        "/usr/share/pademelon/applications",
-        NULL,
-    };
+static int exec_unescape(const char *exec, char *out);
+static int desktop_key(const char *key, size_t len);
+static void load_lazy_fields(struct dapplication *a);
+static struct dapplication *parse_desktop_entry(const char *data, size_t size, const char *id, size_t idlen,
+        const char *lazy_path);
+static struct dcategory *parse_categories(char *string);
+static int search_path(const char *name, const char *path);
+static int shadowed(const char **dirs, int dir, const char *filename);
+
+static const struct dkey desktop_keys[DESKTOP_KEYS_SIZE] = {
+    [0]  = { "X-Pademelon-Settings",  KeyLazyString,  offsetof(struct dapplication, settings), LazySettings },
+    [1]  = { "Comment",               KeyLazyString,  offsetof(struct dapplication, desc), LazyDesc },
+    [2]  = { "TryExec",               KeyString,      offsetof(struct dapplication, try_exec) },
+    [4]  = { "Hidden",                KeyHidden,      0 },
+    [6]  = { "Name",                  KeyLazyString,  offsetof(struct dapplication, display_name), LazyDisplayName },
+    [7]  = { "Categories",            KeyCategories,  0 },
+    [8]  = { "X-Pademelon-Test",      KeyString,      offsetof(struct dapplication, test_cmd) },
+    [10] = { "X-Pademelon-After",     KeyString,      offsetof(struct dapplication, after) },
+    [12] = { "X-Pademelon-Notify",    KeyNotify,      0 },
+    [13] = { "Exec",                  KeyString,      offsetof(struct dapplication, launch_cmd) },
+    [14] = { "X-Pademelon-Restart",   KeyRestart,     0 },
+};
+
+static char *executable_cache_path = NULL;
+static struct executable_cache_entry *executable_cache = NULL;
+static size_t executable_cache_size = 0;
+
+
+const char *application_desc(struct dapplication *a) {
+    if (!a)
+        return NULL;
+    load_lazy_fields(a);
+    return a->desc;
+}
 
-    if (!dirs[0]) {
-        dirs[0] = user_data_path("applications");
+const char *application_display_name(struct dapplication *a) {
+    if (!a)
+        return NULL;
+    load_lazy_fields(a);
+    return a->display_name;
+}
+
+const char *application_settings(struct dapplication *a) {
+    if (!a)
+        return NULL;
+    load_lazy_fields(a);
+    return a->settings;
+}
+
+void clear_executable_cache(void) {
+    size_t i;
+
+    for (i = 0; i < executable_cache_size; i++)
+        free(executable_cache[i].name);
+    free(executable_cache);
+    free(executable_cache_path);
+    executable_cache = NULL;
+    executable_cache_path = NULL;
+    executable_cache_size = 0;
+}
+
+const char **desktop_entry_dirs(void) {
+    /* resolved only once; entries in earlier dirs shadow entries with the same id in later ones */
+    static const char **dirs = NULL;
+    size_t i, j, n;
+    char **system_dirs;
+    const char **temp;
+
+    if (dirs)
+        return dirs;
+
+    system_dirs = system_data_dirs("applications");
+    for (n = 0; system_dirs[n]; n++);
+    temp = malloc(sizeof(char *) * (n + 2));
+    if (!temp)
+        die("Unable to allocate memory for desktop entry dirs");
+
+    temp[0] = user_data_path("applications");
+    for (i = 0, n = 1; system_dirs[i]; i++) {
+        /* only the first occurrence of a dir counts */
+        for (j = 0; j < n && strcmp(temp[j], system_dirs[i]) != 0; j++);
+        if (j < n)
+            free(system_dirs[i]);
+        else
+            temp[n++] = system_dirs[i];
     }
+    temp[n] = NULL;
+    free(system_dirs);
 
+    dirs = temp;
     return dirs;
 }
 
-int desktop_file_callback(void* user, const char* section, const char* name, const char* value) {
-    struct dapplication *app = (struct dapplication *) user;
-    char **write_to_str = NULL;
+int desktop_key(const char *key, size_t len) {
+    unsigned int h;
 
-    if (strcmp(section, "Desktop Entry") != 0)
-        return 1;
+    if (len == 0)
+        return -1;
+    h = DESKTOP_KEY_HASH(key, len);
+    if (desktop_keys[h].type == KeyUnknown || strlen(desktop_keys[h].name) != len
+            || memcmp(desktop_keys[h].name, key, len) != 0)
+        return -1;
+    return (int) h;
+}
 
-    /* TryExec (extra handling) */
-    if (strcmp(name, "TryExec") == 0) {
-        app->test_cmd = realloc(app->test_cmd, sizeof(char) * (strlen("test -x ") + strlen(value) + 1));
-        if (!app->test_cmd)
-            die("Unable to allocate memory for application attribute");
-        strcpy(app->test_cmd, "test -x ");
-        strcat(app->test_cmd, value);
-        return 1;
-    }
-
-    /* string attributes */
-    if (strcmp(name, "Name") == 0)
-        write_to_str = &app->display_name;
-    else if (strcmp(name, "Comment") == 0)
-        write_to_str = &app->desc;
-    else if (strcmp(name, "Exec") == 0)
-        write_to_str = &app->launch_cmd;
-    else if (strcmp(name, "X-Pademelon-Settings") == 0)
-        write_to_str = &app->settings;
-
-    if (write_to_str) {
-        *write_to_str = realloc(*write_to_str, sizeof(char) * (strlen(value) + 1));
-        if (!*write_to_str)
-            die("Unable to allocate memory for application attribute");
-        strcpy(*write_to_str, value);
-        return 1;
+int executable_available(const char *name) {
+    size_t i;
+    const char *path;
+    struct executable_cache_entry *temp;
+
+    if (!name || name[0] == '\0')
+        return 0;
+
+    /* paths are checked directly */
+    if (strchr(name, '/'))
+        return access(name, X_OK) == 0;
+
+    path = getenv("PATH");
+    if (!path)
+        path = DEFAULT_PATH;
+
+    /* drop cache if $PATH has changed */
+    if (executable_cache_path && strcmp(executable_cache_path, path) != 0)
+        clear_executable_cache();
+
+    for (i = 0; i < executable_cache_size; i++)
+        if (strcmp(executable_cache[i].name, name) == 0)
+            return executable_cache[i].available;
+
+    /* add result to cache (just search if that fails) */
+    temp = realloc(executable_cache, sizeof(struct executable_cache_entry) * (executable_cache_size + 1));
+    if (!temp)
+        return search_path(name, path);
+    executable_cache = temp;
+    if (!executable_cache_path && !(executable_cache_path = strdup(path)))
+        return search_path(name, path);
+    if (!(executable_cache[executable_cache_size].name = strdup(name)))
+        return search_path(name, path);
+    executable_cache[executable_cache_size].available = search_path(name, path);
+    return executable_cache[executable_cache_size++].available;
+}
+
+char **exec_to_argv(const char *exec) {
+    size_t len, maxargs, argc;
+    int quoted, in_arg;
+    char *unescaped, *from, *to;
+    char **argv;
+
+    if (!exec)
+        return NULL;
+
+    /* room for the pointers and a copy of the string (args are never longer than the input) */
+    len = strlen(exec);
+    maxargs = len / 2 + 2;
+    argv = malloc(sizeof(char *) * maxargs + (len + 1) * 2);
+    if (!argv)
+        return NULL;
+    unescaped = (char *) &argv[maxargs];
+    to = unescaped + len + 1;
+
+    if (!exec_unescape(exec, unescaped)) {
+        free(argv);
+        return NULL;
     }
 
-    /* category */
-    if (strcmp(name, "Categories") == 0) {
-        app->category = parse_categories(value);
-        return 1;
+    argc = 0;
+    quoted = 0;
+    in_arg = 0;
+    for (from = unescaped; *from; from++) {
+        if (quoted) {
+            if (*from == '"') {
+                quoted = 0;
+                continue;
+            }
+            if (*from == '\\') {
+                /* only a few characters may be escaped inside of quotes */
+                if (!from[1] || !strchr(EXEC_QUOTED_ESCAPES, from[1]))
+                    goto shell_required;
+                from++;
+            } else if (*from == '$' || *from == '`') {
+                /* the shell would still expand these inside of double quotes */
+                goto shell_required;
+            }
+        } else if (*from == ' ') {
+            if (in_arg) {
+                *to++ = '\0';
+                in_arg = 0;
+            }
+            continue;
+        } else if (*from == '"') {
+            quoted = 1;
+            if (!in_arg) {
+                argv[argc++] = to;
+                in_arg = 1;
+            }
+            continue;
+        } else if (strchr(EXEC_RESERVED_CHARS, *from)) {
+            goto shell_required;
+        }
+
+        if (*from == '%') {
+            if (from[1] == '%') {
+                from++;
+            } else if (from[1] && strchr(EXEC_FIELD_CODES, from[1])) {
+                /* drop field codes, as well as arguments consisting only of one */
+                from++;
+                if (!in_arg && (from[1] == ' ' || from[1] == '\0'))
+                    continue;
+                if (!in_arg) {
+                    argv[argc++] = to;
+                    in_arg = 1;
+                }
+                continue;
+            } else {
+                goto shell_required;
+            }
+        }
+
+        if (!in_arg) {
+            argv[argc++] = to;
+            in_arg = 1;
+        }
+        *to++ = *from;
     }
 
+    if (quoted || argc == 0)
+        goto shell_required;
+    if (in_arg)
+        *to = '\0';
+    argv[argc] = NULL;
+    return argv;
+
+shell_required:
+    free(argv);
+    return NULL;
+}
+
+int exec_unescape(const char *exec, char *out) {
+    /* resolve escape sequences of the desktop entry string type */
+    for (; *exec; exec++, out++) {
+        if (*exec != '\\') {
+            *out = *exec;
+            continue;
+        }
+
+        switch (*++exec) {
+            case 's':   *out = ' '; break;
+            case 'n':   *out = '\n'; break;
+            case 't':   *out = '\t'; break;
+            case 'r':   *out = '\r'; break;
+            case '\\':  *out = '\\'; break;
+            case '\0':  return 0;
+            default:    /* keep unknown sequences for the quoting rules */
+                        *out++ = '\\';
+                        *out = *exec;
+        }
+    }
+    *out = '\0';
     return 1;
 }
 
@@ -89,6 +321,11 @@ struct dapplication *application_by_category(const char **dirs, const char *cate
     if (!dirs || !category)
         return NULL;
 
+    /* try the live index of the daemon and the persistent index first */
+    if (dindex_application_by_category(dirs, category, &app)
+            || dcache_application_by_category(dirs, category, &app))
+        return app;
+
     for (i = 0; dirs[i]; i++) {
         /* open directory for iteration */
         directory = opendir(dirs[i]);
@@ -127,8 +364,12 @@ struct dapplication *application_by_category(const char **dirs, const char *cate
             } else if (!S_ISREG(filestats.st_mode))
                 continue;
 
-            app = parse_desktop_file(subpath, diriter->d_name);
-            if (!app || !app->category || !app->category->xdg_name
+            /* entries with the same id in a dir of higher priority take precedence */
+            if (shadowed(dirs, i, diriter->d_name))
+                continue;
+
+            app = parse_desktop_file(subpath, diriter->d_name, 1);
+            if (!app || app->hidden || !app->category || !app->category->xdg_name
                     || strcmp(app->category->xdg_name, category) != 0) {
                 free_application(app);
                 continue;
@@ -159,6 +400,11 @@ struct dapplication *application_by_name(const char **dirs, const char *name, co
     if (!dirs || !name)
         return NULL;
 
+    /* try the live index of the daemon and the persistent index first */
+    if (dindex_application_by_name(dirs, name, expected_category, &app)
+            || dcache_application_by_name(dirs, name, expected_category, &app))
+        return app;
+
     for (i = 0; dirs[i]; i++) {
         char filename[strlen(name) + strlen("/.desktop") + 1];
         char filepath[strlen(dirs[i]) + strlen(name) + strlen("/.desktop") + 1];
@@ -182,10 +428,12 @@ struct dapplication *application_by_name(const char **dirs, const char *name, co
         } else if (!S_ISREG(filestats.st_mode))
             continue;
 
-        app = parse_desktop_file(filepath, filename);
-        if (!app || (expected_category && (!app->category || strcmp(expected_category, app->category->xdg_name) != 0))) {
+        /* the first entry found shadows all others with the same id */
+        app = parse_desktop_file(filepath, filename, 1);
+        if (!app || app->hidden
+                || (expected_category && (!app->category || strcmp(expected_category, app->category->xdg_name) != 0))) {
             free_application(app);
-            continue;
+            return NULL;
         } else {
             return app;
         }
@@ -193,57 +441,270 @@ struct dapplication *application_by_name(const char **dirs, const char *name, co
     return NULL;
 }
 
-struct dcategory *parse_categories(const char *string) {
-    struct dcategory *d;
-    char *current;
-    char *token_string = strdup(string);
-    if (!token_string) {
-        // @TODO additional handling?
-        return NULL;
+void load_lazy_fields(struct dapplication *a) {
+    int i, fd;
+    size_t size = 0;
+    char *block, *p;
+    struct stat filestats;
+    struct dapplication *full;
+    char **fields[LAZY_FIELDS] = { &a->display_name, &a->desc, &a->settings };
+
+    if (!a->path)
+        return;
+
+    fd = open(a->path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1 && fstat(fd, &filestats) == 0 && filestats.st_size == a->size
+            && filestats.st_mtim.tv_sec == a->mtime.tv_sec && filestats.st_mtim.tv_nsec == a->mtime.tv_nsec) {
+        /* read the fields from the recorded positions */
+        for (i = 0; i < LAZY_FIELDS; i++)
+            size += a->lazy[i].len + 1;
+        block = p = malloc(size);
+        if (!block)
+            die("Unable to allocate memory for application attribute");
+        for (i = 0; i < LAZY_FIELDS; i++) {
+            if (a->lazy[i].len == 0 || pread(fd, p, a->lazy[i].len, a->lazy[i].offset) != (ssize_t) a->lazy[i].len)
+                continue;
+            p[a->lazy[i].len] = '\0';
+            *fields[i] = p;
+            p += a->lazy[i].len + 1;
+        }
+    } else {
+        /* the file has changed since, parse it again */
+        full = parse_desktop_file(a->path, strrchr(a->path, '/') ? strrchr(a->path, '/') + 1 : a->path, 0);
+        const char *values[LAZY_FIELDS] = {
+            full ? full->display_name : NULL, full ? full->desc : NULL, full ? full->settings : NULL,
+        };
+        for (i = 0; i < LAZY_FIELDS; i++)
+            if (values[i])
+                size += strlen(values[i]) + 1;
+        block = p = malloc(size ? size : 1);
+        if (!block)
+            die("Unable to allocate memory for application attribute");
+        for (i = 0; i < LAZY_FIELDS; i++) {
+            if (!values[i])
+                continue;
+            strcpy(p, values[i]);
+            *fields[i] = p;
+            p += strlen(values[i]) + 1;
+        }
+        free_application(full);
     }
 
-    current = strtok(token_string, ";");
-    if (!current)
-        return NULL;
-    do {
-        if (strcmp(string, "TrayIcon") == 0)
+    if (fd != -1)
+        close(fd);
+    a->lazy_strings = block;
+    a->path = NULL;
+}
+
+struct dcategory *parse_categories(char *string) {
+    /* string is tokenized in place */
+    struct dcategory *d;
+    char *current, *saveptr = NULL;
+
+    for (current = strtok_r(string, ";", &saveptr); current; current = strtok_r(NULL, ";", &saveptr)) {
+        if (strcmp(current, "TrayIcon") == 0)
             d = find_category("Applet");
-        else if (strcmp(string, "Panel") == 0)
+        else if (strcmp(current, "Panel") == 0)
             d = find_category("Status");
         else
             d = find_category(current);
 
         if (d)
             return d;
-    } while ((current = strtok(NULL, ";")));
+    }
 
     return NULL;
 }
 
-struct dapplication *parse_desktop_file(const char *filepath, const char *filename) {
-    int status;
-    struct dapplication *app = calloc(1, sizeof(struct dapplication));
+struct dapplication *parse_desktop_entry(const char *data, size_t size, const char *id, size_t idlen,
+        const char *lazy_path) {
+    int k;
+    size_t arena_size;
+    char *arena;
+    const char *line, *next, *eol, *eq, *end = data + size;
+    const char *key_end, *value;
+    struct dspan values[DESKTOP_KEYS_SIZE] = {{0}};
+    struct dapplication *app;
+    int in_main_group = 0;
+
+    for (line = data; line < end; line = next) {
+        eol = memchr(line, '\n', (size_t) (end - line));
+        next = eol ? eol + 1 : end;
+        if (!eol)
+            eol = end;
+
+        /* strip whitespace */
+        while (line < eol && (*line == ' ' || *line == '\t'))
+            line++;
+        while (eol > line && (eol[-1] == ' ' || eol[-1] == '\t' || eol[-1] == '\r'))
+            eol--;
+        if (line == eol || *line == '#' || *line == ';')
+            continue;
+
+        /* group header */
+        if (*line == '[') {
+            /* other groups are irrelevant for lazy parsing */
+            if (lazy_path && in_main_group)
+                break;
+            in_main_group = (size_t) (eol - line) == strlen(DESKTOP_ENTRY_GROUP)
+                && memcmp(line, DESKTOP_ENTRY_GROUP, strlen(DESKTOP_ENTRY_GROUP)) == 0;
+            continue;
+        }
+        if (!in_main_group)
+            continue;
+
+        /* key-value pair, later values overwrite earlier ones */
+        eq = memchr(line, '=', (size_t) (eol - line));
+        if (!eq)
+            continue;
+        for (key_end = eq; key_end > line && (key_end[-1] == ' ' || key_end[-1] == '\t'); key_end--);
+        for (value = eq + 1; value < eol && (*value == ' ' || *value == '\t'); value++);
+
+        k = desktop_key(line, (size_t) (key_end - line));
+        if (k < 0)
+            continue;
+        values[k].start = value;
+        values[k].len = (size_t) (eol - value);
+    }
+
+    /* the struct and all of its strings share one allocation */
+    arena_size = sizeof(struct dapplication) + idlen + 1 + (lazy_path ? strlen(lazy_path) + 1 : 0);
+    for (k = 0; k < DESKTOP_KEYS_SIZE; k++)
+        if (values[k].start && (desktop_keys[k].type == KeyString
+                    || (desktop_keys[k].type == KeyLazyString && !lazy_path)))
+            arena_size += values[k].len + 1;
+    app = calloc(1, arena_size);
     if (!app)
         return NULL;
+    arena = (char *) (app + 1);
+
+    memcpy(arena, id, idlen);
+    arena[idlen] = '\0';
+    app->id_name = arena;
+    arena += idlen + 1;
+    if (lazy_path) {
+        strcpy(arena, lazy_path);
+        app->path = arena;
+        arena += strlen(lazy_path) + 1;
+    }
 
-    app->id_name = strdup(filename);
-    if (!app->id_name) {
-        free_application(app);
-        return NULL;
+    for (k = 0; k < DESKTOP_KEYS_SIZE; k++) {
+        if (!values[k].start)
+            continue;
+
+        switch (desktop_keys[k].type) {
+            case KeyLazyString:
+                if (lazy_path) {
+                    /* only remember the position */
+                    app->lazy[desktop_keys[k].lazy].offset = (off_t) (values[k].start - data);
+                    app->lazy[desktop_keys[k].lazy].len = values[k].len;
+                    break;
+                }
+                /* fall through */
+            case KeyString:
+                memcpy(arena, values[k].start, values[k].len);
+                arena[values[k].len] = '\0';
+                *(char **) ((char *) app + desktop_keys[k].field) = arena;
+                arena += values[k].len + 1;
+                break;
+            case KeyHidden:
+                /* hidden entries are treated as deleted, but still shadow other entries */
+                app->hidden = values[k].len == strlen("true") && memcmp(values[k].start, "true", values[k].len) == 0;
+                break;
+            case KeyNotify:
+                app->notify = values[k].len == strlen("true") && memcmp(values[k].start, "true", values[k].len) == 0;
+                break;
+            case KeyRestart:
+                app->restart = parse_restart_policy(values[k].start, values[k].len);
+                if (app->restart == RestartUnset)
+                    DBGPRINT("Invalid restart policy for '%s'\n", app->id_name);
+                break;
+            case KeyCategories: {
+                char categories[values[k].len + 1];
+                memcpy(categories, values[k].start, values[k].len);
+                categories[values[k].len] = '\0';
+                app->category = parse_categories(categories);
+                break;
+            }
+            default:
+                break;
+        }
     }
 
-    if (!STR_ENDS_WITH(filename, ".desktop")) {
-        free_application(app);
+    return app;
+}
+
+struct dapplication *parse_desktop_file(const char *filepath, const char *filename, int lazy) {
+    int fd;
+    void *data = NULL;
+    struct stat filestats;
+    struct dapplication *app;
+
+    if (!STR_ENDS_WITH(filename, DESKTOP_FILE_ENDING))
         return NULL;
+
+    fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &filestats) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    /* empty files can not be mapped */
+    if (filestats.st_size > 0) {
+        data = mmap(NULL, (size_t) filestats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return NULL;
+        }
     }
+    close(fd);
+
+    app = parse_desktop_entry(data ? (const char *) data : "", (size_t) filestats.st_size,
+            filename, strlen(filename) - strlen(DESKTOP_FILE_ENDING), lazy ? filepath : NULL);
+    if (app && lazy) {
+        /* used to detect changes before the lazy fields are loaded */
+        app->size = filestats.st_size;
+        app->mtime = filestats.st_mtim;
+    }
+
+    if (data)
+        munmap(data, (size_t) filestats.st_size);
+    return app;
+}
 
-    app->id_name[strlen(app->id_name) - strlen(".desktop")] = '\0';
+int search_path(const char *name, const char *path) {
+    const char *dir, *end;
+    size_t dirlen;
 
-    status = ini_parse(filepath, &desktop_file_callback, (void *) app);
-    if (status < 0) {
-        free_application(app);
-        return NULL;
-    } else {
-        return app;
+    for (dir = path; ; dir = end + 1) {
+        end = strchr(dir, ':');
+        dirlen = end ? (size_t) (end - dir) : strlen(dir);
+
+        /* an empty entry is the current directory */
+        char filepath[dirlen + strlen(name) + 3];
+        if (dirlen == 0)
+            snprintf(filepath, sizeof(filepath), "./%s", name);
+        else
+            snprintf(filepath, sizeof(filepath), "%.*s/%s", (int) dirlen, dir, name);
+
+        if (access(filepath, X_OK) == 0)
+            return 1;
+        if (!end)
+            return 0;
+    }
+}
+
+int shadowed(const char **dirs, int dir, const char *filename) {
+    int i;
+    struct stat filestats;
+
+    for (i = 0; i < dir; i++) {
+        char filepath[strlen(dirs[i]) + strlen("/") + strlen(filename) + 1];
+        snprintf(filepath, sizeof(filepath), "%s/%s", dirs[i], filename);
+        if (stat(filepath, &filestats) == 0 && S_ISREG(filestats.st_mode))
+            return 1;
     }
+    return 0;
 }
@@ -1,8 +1,35 @@
 #ifndef H_DESKTOP_FILES
 #define H_DESKTOP_FILES
 
+void clear_executable_cache(void);
 const char **desktop_entry_dirs(void);
-struct dapplication *parse_desktop_file(const char *filepath, const char *filename);
+/*
+ * check whether an executable is available as defined for TryExec by the desktop entry spec
+ *
+ * names without a slash are searched for in $PATH
+ * results of $PATH lookups are cached until clear_executable_cache() is called or $PATH changes
+ */
+int executable_available(const char *name);
+/*
+ * split an Exec value into an argument vector as defined by the desktop entry spec
+ *
+ * field codes are removed, as pademelon never passes files or urls
+ * NULL is returned if the value relies on shell syntax or is invalid
+ * the vector is allocated in one block and has to be freed with free()
+ */
+char **exec_to_argv(const char *exec);
+/*
+ * parse a desktop entry file into a single allocation
+ *
+ * in lazy mode parsing stops at the end of the [Desktop Entry] group and only the position of
+ * display-only fields (Name, Comment, X-Pademelon-Settings) is recorded
+ * use the getters below to access these fields
+ */
+struct dapplication *parse_desktop_file(const char *filepath, const char *filename, int lazy);
+/* get fields that might not be loaded yet (NULL if not present) */
+const char *application_desc(struct dapplication *a);
+const char *application_display_name(struct dapplication *a);
+const char *application_settings(struct dapplication *a);
 struct dapplication *application_by_category(const char **dirs, const char *category);
 struct dapplication *application_by_name(const char **dirs, const char *name, const char *expected_category);
 
@@ -0,0 +1,343 @@
+#include "common.h"
+#include "desktop-application.h"
+#include "desktop-files.h"
+#include "desktop-index.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DESKTOP_FILE_ENDING     ".desktop"
+#define DINDEX_WATCH_MASK       (IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE \
+                                    | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+struct dindex_entry {
+    int dir; /* index into index_dirs, lower values shadow higher ones */
+    int shadowed; /* an entry with the same id exists in a dir of higher priority */
+    struct dapplication *application;
+    struct dindex_entry *next_id, *next_category; /* bucket chains, sorted by dir */
+};
+
+static void drop_dir(int dir);
+static unsigned int hash(const char *s);
+static void insert(struct dindex_entry *e);
+static int is_link(int dir, const char *filename);
+static void load_file(int dir, const char *filename);
+static void remove_entry(int dir, const char *id);
+static void scan_dir(int dir);
+static void unlink_entry(struct dindex_entry *e);
+static void update_shadowing(const char *id);
+static void watch_dir(int dir);
+
+static struct dindex_entry *by_id[DINDEX_BUCKETS];
+static struct dindex_entry *by_category[DINDEX_BUCKETS];
+static const char **index_dirs = NULL;
+static int *watches = NULL;
+static int ndirs = 0;
+static int inotify_fd = -1;
+
+
+int dindex_application_by_category(const char **dirs, const char *category, struct dapplication **app) {
+    struct dindex_entry *e;
+
+    *app = NULL;
+    if (inotify_fd < 0 || dirs != index_dirs || !category)
+        return 0;
+
+    for (e = by_category[hash(category)]; e; e = e->next_category) {
+        if (!e->shadowed && !e->application->hidden
+                && strcmp(e->application->category->xdg_name, category) == 0) {
+            *app = copy_application(e->application);
+            break;
+        }
+    }
+    return 1;
+}
+
+int dindex_application_by_name(const char **dirs, const char *name, const char *expected_category,
+        struct dapplication **app) {
+    struct dindex_entry *e;
+
+    *app = NULL;
+    if (inotify_fd < 0 || dirs != index_dirs || !name)
+        return 0;
+
+    /* chains are sorted by dir, so the first entry with the id is the one that is not shadowed */
+    for (e = by_id[hash(name)]; e && strcmp(e->application->id_name, name) != 0; e = e->next_id);
+    if (!e || e->application->hidden)
+        return 1;
+    if (expected_category && (!e->application->category
+                || strcmp(expected_category, e->application->category->xdg_name) != 0))
+        return 1;
+    *app = copy_application(e->application);
+    return 1;
+}
+
+int dindex_fd(void) {
+    return inotify_fd;
+}
+
+void dindex_free(void) {
+    int i;
+
+    for (i = 0; i < ndirs; i++)
+        drop_dir(i);
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+    free(watches);
+    watches = NULL;
+    index_dirs = NULL;
+    ndirs = 0;
+    inotify_fd = -1;
+}
+
+int dindex_init(const char **dirs) {
+    int i;
+
+    if (!dirs)
+        return -1;
+    if (inotify_fd >= 0)
+        dindex_free();
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        DBGPRINT("Unable to initialize inotify: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (ndirs = 0; dirs[ndirs]; ndirs++);
+    watches = malloc(sizeof(int) * (size_t) MAX_INT(ndirs, 1));
+    if (!watches)
+        die("Unable to allocate memory for desktop entry index");
+    index_dirs = dirs;
+
+    for (i = 0; i < ndirs; i++) {
+        watches[i] = -1;
+        watch_dir(i);
+    }
+    return inotify_fd;
+}
+
+void dindex_process_events(void) {
+    int i, dir;
+    ssize_t len;
+    char *ptr;
+    const struct inotify_event *event;
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    if (inotify_fd < 0)
+        return;
+
+    while ((len = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (ptr = buffer; ptr < buffer + len; ptr += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *) ptr;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                /* events were lost, start over */
+                DBGPRINT("inotify queue overflow, rescanning desktop entries\n");
+                for (i = 0; i < ndirs; i++) {
+                    drop_dir(i);
+                    if (watches[i] >= 0)
+                        scan_dir(i);
+                }
+                continue;
+            }
+
+            for (dir = 0; dir < ndirs && watches[dir] != event->wd; dir++);
+            if (dir == ndirs)
+                continue;
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                DBGPRINT("Desktop entry dir '%s' was removed\n", index_dirs[dir]);
+                if (!(event->mask & IN_IGNORED))
+                    inotify_rm_watch(inotify_fd, watches[dir]);
+                watches[dir] = -1;
+                drop_dir(dir);
+                continue;
+            }
+
+            if (event->len == 0 || (event->mask & IN_ISDIR)
+                    || !STR_ENDS_WITH(event->name, DESKTOP_FILE_ENDING))
+                continue;
+
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                char id[strlen(event->name) + 1];
+                strcpy(id, event->name);
+                id[strlen(id) - strlen(DESKTOP_FILE_ENDING)] = '\0';
+                remove_entry(dir, id);
+            } else if (!(event->mask & IN_CREATE) || is_link(dir, event->name)) {
+                /* new files are loaded once they have been written, links are complete right away */
+                load_file(dir, event->name);
+            }
+        }
+    }
+
+    if (len < 0 && errno != EAGAIN && errno != EINTR)
+        DBGPRINT("Unable to read inotify events: %s\n", strerror(errno));
+}
+
+void dindex_rewatch(void) {
+    int i;
+
+    if (inotify_fd < 0)
+        return;
+
+    for (i = 0; i < ndirs; i++)
+        if (watches[i] < 0)
+            watch_dir(i);
+}
+
+void drop_dir(int dir) {
+    int i;
+    struct dindex_entry *e, *next;
+
+    for (i = 0; i < DINDEX_BUCKETS; i++) {
+        for (e = by_id[i]; e; e = next) {
+            next = e->next_id;
+            if (e->dir == dir)
+                unlink_entry(e);
+        }
+    }
+}
+
+unsigned int hash(const char *s) {
+    unsigned int h = 5381;
+
+    for (; *s; s++)
+        h = h * 33 + (unsigned char) *s;
+    return h & (DINDEX_BUCKETS - 1);
+}
+
+void insert(struct dindex_entry *e) {
+    struct dindex_entry **link;
+
+    /* keep the chains sorted by dir, so the first match is the one with the highest priority */
+    for (link = &by_id[hash(e->application->id_name)]; *link && (*link)->dir <= e->dir;
+            link = &(*link)->next_id);
+    e->next_id = *link;
+    *link = e;
+    update_shadowing(e->application->id_name);
+
+    e->next_category = NULL;
+    if (!e->application->category || !e->application->category->xdg_name)
+        return;
+    for (link = &by_category[hash(e->application->category->xdg_name)]; *link && (*link)->dir <= e->dir;
+            link = &(*link)->next_category);
+    e->next_category = *link;
+    *link = e;
+}
+
+int is_link(int dir, const char *filename) {
+    struct stat filestats;
+    char filepath[strlen(index_dirs[dir]) + strlen("/") + strlen(filename) + 1];
+
+    /* a hardlink is a regular file that already had a name */
+    snprintf(filepath, sizeof(filepath), "%s/%s", index_dirs[dir], filename);
+    if (lstat(filepath, &filestats) != 0)
+        return 0;
+    return S_ISLNK(filestats.st_mode) || (S_ISREG(filestats.st_mode) && filestats.st_nlink > 1);
+}
+
+void load_file(int dir, const char *filename) {
+    struct dapplication *app;
+    struct dindex_entry *e;
+    struct stat filestats = {0};
+
+    char filepath[strlen(index_dirs[dir]) + strlen("/") + strlen(filename) + 1];
+    snprintf(filepath, sizeof(filepath), "%s/%s", index_dirs[dir], filename);
+
+    char id[strlen(filename) + 1];
+    strcpy(id, filename);
+    id[strlen(id) - strlen(DESKTOP_FILE_ENDING)] = '\0';
+    remove_entry(dir, id);
+
+    /* check if path is actually a regular file */
+    if (stat(filepath, &filestats) != 0 || !S_ISREG(filestats.st_mode))
+        return;
+
+    app = parse_desktop_file(filepath, filename, 1);
+    if (!app)
+        return;
+
+    e = malloc(sizeof(struct dindex_entry));
+    if (!e)
+        die("Unable to allocate memory for desktop entry index");
+    e->dir = dir;
+    e->application = app;
+    insert(e);
+}
+
+void remove_entry(int dir, const char *id) {
+    struct dindex_entry *e;
+
+    for (e = by_id[hash(id)]; e; e = e->next_id) {
+        if (e->dir == dir && strcmp(e->application->id_name, id) == 0) {
+            unlink_entry(e);
+            return;
+        }
+    }
+}
+
+void scan_dir(int dir) {
+    DIR *directory;
+    struct dirent *diriter;
+
+    directory = opendir(index_dirs[dir]);
+    if (!directory) {
+        DBGPRINT("Unable to index applications from directory '%s'\n", index_dirs[dir]);
+        return;
+    }
+
+    while ((diriter = readdir(directory)) != NULL) {
+        if (STR_ENDS_WITH(diriter->d_name, DESKTOP_FILE_ENDING))
+            load_file(dir, diriter->d_name);
+    }
+
+    if (closedir(directory))
+        DBGPRINT("%s\n", "Unable to close directory");
+}
+
+void unlink_entry(struct dindex_entry *e) {
+    struct dindex_entry **link;
+
+    for (link = &by_id[hash(e->application->id_name)]; *link && *link != e; link = &(*link)->next_id);
+    if (*link)
+        *link = e->next_id;
+    /* an entry in a dir of lower priority might be visible now */
+    update_shadowing(e->application->id_name);
+
+    if (e->application->category && e->application->category->xdg_name) {
+        for (link = &by_category[hash(e->application->category->xdg_name)]; *link && *link != e;
+                link = &(*link)->next_category);
+        if (*link)
+            *link = e->next_category;
+    }
+
+    free_application(e->application);
+    free(e);
+}
+
+void update_shadowing(const char *id) {
+    int first = 1;
+    struct dindex_entry *e;
+
+    for (e = by_id[hash(id)]; e; e = e->next_id) {
+        if (strcmp(e->application->id_name, id) != 0)
+            continue;
+        e->shadowed = !first;
+        first = 0;
+    }
+}
+
+void watch_dir(int dir) {
+    /* add the watch first, so no change between scanning and watching is lost */
+    watches[dir] = inotify_add_watch(inotify_fd, index_dirs[dir], DINDEX_WATCH_MASK);
+    if (watches[dir] < 0) {
+        DBGPRINT("Unable to watch directory '%s': %s\n", index_dirs[dir], strerror(errno));
+        return;
+    }
+    scan_dir(dir);
+}
@@ -0,0 +1,32 @@
+#ifndef H_DESKTOP_INDEX
+#define H_DESKTOP_INDEX
+
+#include "desktop-application.h"
+
+#define DINDEX_BUCKETS          256 /* power of two */
+
+/*
+ * in-memory index of all desktop entries, kept up to date with inotify
+ *
+ * dindex_init() parses all entries in dirs once and returns the inotify file descriptor (or -1)
+ * the descriptor becomes readable when one of the dirs has changed, in which case
+ * dindex_process_events() only reparses the files that were added, changed or removed
+ */
+int dindex_init(const char **dirs);
+int dindex_fd(void);
+void dindex_free(void);
+void dindex_process_events(void);
+/* add watches for dirs that did not exist before */
+void dindex_rewatch(void);
+
+/*
+ * look up an application in the index
+ *
+ * returns 0 if the index is not initialized for dirs, 1 otherwise
+ * *app is set to a copy of the entry that has to be freed with free_application() or NULL
+ */
+int dindex_application_by_category(const char **dirs, const char *category, struct dapplication **app);
+int dindex_application_by_name(const char **dirs, const char *name, const char *expected_category,
+        struct dapplication **app);
+
+#endif /* H_DESKTOP_INDEX */
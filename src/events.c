@@ -0,0 +1,245 @@
+#include "common.h"
+#include "events.h"
+#include "signals.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+enum eventtype {
+    EventFd, EventSignal, EventTimer,
+};
+
+struct event {
+    enum eventtype type;
+    int fd;
+    int removed; /* freed after the current dispatch */
+    event_handler handler;
+    event_handler output_handler; /* EPOLLOUT is only watched while this is set */
+    void *data;
+    struct event *next;
+};
+
+static struct event *add_event(enum eventtype type, int fd, event_handler handler, void *data);
+static void free_removed(void);
+static void handle_signals(void);
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static sigset_t signal_mask;
+static signal_handler signal_handlers[SIGNAL_MAX];
+static struct event *events_head = NULL;
+
+
+struct event *add_event(enum eventtype type, int fd, event_handler handler, void *data) {
+    struct event *e;
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    e = calloc(1, sizeof(struct event));
+    if (!e)
+        die("Unable to allocate memory for event");
+    e->type = type;
+    e->fd = fd;
+    e->handler = handler;
+    e->data = data;
+
+    ev.data.ptr = e;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        free(e);
+        return NULL;
+    }
+
+    e->next = events_head;
+    events_head = e;
+    return e;
+}
+
+int events_add(int fd, event_handler handler, void *data) {
+    if (epoll_fd < 0 || fd < 0)
+        return 0;
+    return add_event(EventFd, fd, handler, data) != NULL;
+}
+
+int events_add_signal(int signal, signal_handler handler) {
+    int fd;
+
+    if (epoll_fd < 0 || signal <= 0 || signal >= SIGNAL_MAX)
+        return 0;
+
+    /* the signal is only delivered through the signalfd from now on */
+    if (sigaddset(&signal_mask, signal) == -1 || !block_signal(signal))
+        return 0;
+    signal_handlers[signal] = handler;
+
+    fd = signalfd(signal_fd, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1)
+        return 0;
+    if (signal_fd < 0) {
+        signal_fd = fd;
+        if (!add_event(EventSignal, signal_fd, NULL, NULL))
+            return 0;
+    }
+    return 1;
+}
+
+int events_add_timer(long timeout_milli, event_handler handler, void *data) {
+    int fd;
+    struct itimerspec its = {0};
+
+    if (epoll_fd < 0)
+        return -1;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    /* a zero value would disarm the timer */
+    its.it_value.tv_sec = timeout_milli / 1000;
+    its.it_value.tv_nsec = (timeout_milli % 1000) * 1000000;
+    if (its.it_value.tv_sec <= 0 && its.it_value.tv_nsec <= 0)
+        its.it_value.tv_nsec = 1;
+
+    if (timerfd_settime(fd, 0, &its, NULL) == -1 || !add_event(EventTimer, fd, handler, data)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int events_dispatch(int timeout_milli) {
+    int i, n;
+    uint64_t expirations;
+    struct event *e;
+    struct epoll_event evs[EVENTS_MAX_BATCH];
+
+    if (epoll_fd < 0)
+        return -1;
+
+    n = epoll_wait(epoll_fd, evs, EVENTS_MAX_BATCH, timeout_milli);
+    if (n == -1)
+        return errno == EINTR ? 0 : -1;
+
+    for (i = 0; i < n; i++) {
+        e = (struct event *) evs[i].data.ptr;
+        /* handlers might have removed events of the same batch */
+        if (e->removed)
+            continue;
+
+        switch (e->type) {
+            case EventSignal:
+                handle_signals();
+                break;
+            case EventTimer:
+                if (read(e->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                    break;
+                events_remove(e->fd);
+                if (e->handler)
+                    e->handler(e->data);
+                break;
+            case EventFd:
+                if ((evs[i].events & EPOLLOUT) && e->output_handler)
+                    e->output_handler(e->data);
+                /* errors and hang ups are reported to the read handler */
+                if (!e->removed && (evs[i].events & ~(uint32_t) EPOLLOUT) && e->handler)
+                    e->handler(e->data);
+                break;
+        }
+    }
+
+    free_removed();
+    return n;
+}
+
+void events_free(void) {
+    struct event *e;
+
+    for (e = events_head; e; e = e->next)
+        if (!e->removed)
+            events_remove(e->fd);
+    free_removed();
+
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    epoll_fd = -1;
+    signal_fd = -1;
+}
+
+int events_init(void) {
+    if (epoll_fd >= 0)
+        return 1;
+
+    if (sigemptyset(&signal_mask) == -1)
+        return 0;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    return epoll_fd >= 0;
+}
+
+int events_remove(int fd) {
+    struct event *e;
+
+    for (e = events_head; e; e = e->next) {
+        if (e->removed || e->fd != fd)
+            continue;
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        /* the descriptors of timers and signals are owned by the event loop */
+        if (e->type != EventFd)
+            close(fd);
+        if (e->type == EventSignal)
+            signal_fd = -1;
+        e->removed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+int events_set_output(int fd, event_handler handler) {
+    struct event *e;
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    for (e = events_head; e; e = e->next) {
+        if (e->removed || e->fd != fd || e->type != EventFd)
+            continue;
+        if ((handler != NULL) == (e->output_handler != NULL)) {
+            e->output_handler = handler;
+            return 1;
+        }
+
+        if (handler)
+            ev.events |= EPOLLOUT;
+        ev.data.ptr = e;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1)
+            return 0;
+        e->output_handler = handler;
+        return 1;
+    }
+    return 0;
+}
+
+void free_removed(void) {
+    struct event **link, *e;
+
+    for (link = &events_head; *link; ) {
+        e = *link;
+        if (e->removed) {
+            *link = e->next;
+            free(e);
+        } else {
+            link = &e->next;
+        }
+    }
+}
+
+void handle_signals(void) {
+    struct signalfd_siginfo info;
+
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo < SIGNAL_MAX && signal_handlers[info.ssi_signo])
+            signal_handlers[info.ssi_signo]((int) info.ssi_signo);
+    }
+}
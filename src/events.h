@@ -0,0 +1,42 @@
+#ifndef H_EVENTS
+#define H_EVENTS
+
+#define EVENTS_MAX_BATCH    16
+
+typedef void (*event_handler)(void *data);
+typedef void (*signal_handler)(int signal);
+
+/*
+ * event loop based on epoll
+ *
+ * signals registered with events_add_signal() are blocked and delivered through a signalfd,
+ * so their handlers run synchronously from events_dispatch() instead of interrupting the program
+ * returns 1 on success, 0 otherwise (errno is set)
+ */
+int events_init(void);
+void events_free(void);
+
+/* call handler whenever fd becomes readable */
+int events_add(int fd, event_handler handler, void *data);
+int events_add_signal(int signal, signal_handler handler);
+/*
+ * call handler once after timeout_milli milliseconds
+ *
+ * returns the timer id (a timerfd) that can be passed to events_remove() or -1 on error
+ * the timer is removed automatically after it has fired
+ */
+int events_add_timer(long timeout_milli, event_handler handler, void *data);
+/* additionally call handler (with the data of fd) whenever fd becomes writable, NULL stops watching */
+int events_set_output(int fd, event_handler handler);
+/* stop watching fd (timers are closed as well) */
+int events_remove(int fd);
+
+/*
+ * wait for events and run their handlers
+ *
+ * a negative timeout waits indefinitely
+ * returns the number of handled events, 0 on timeout or signal interruption and -1 on error
+ */
+int events_dispatch(int timeout_milli);
+
+#endif /* H_EVENTS */
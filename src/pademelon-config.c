@@ -5,14 +5,50 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #define PRINT_SECTION(S)            if (printf("\n[%s]\n", (S)) < 0) return -1;
 #define PRINT_PROPERTY_BOOL(K, V)   if (printf("%s = %s\n", (K), (V) ? "True" : "False") < 0) return -1;
+#define PRINT_PROPERTY_INT(K, V)    if (printf("%s = %d\n", (K), (V)) < 0) return -1;
 #define PRINT_PROPERTY_STR(K, V)    if (printf("%s = %s\n", (K), (V)) < 0) return -1;
 #define PRINT_PROPERTY_CAT(C)       if (printf("%s = %s\n", (C)->name, (C)->user_preference) < 0) return -1;
 
 static inline int IS_TRUE(const char *s)       { return strcmp(s, "True") == 0 || strcmp(s, "true") == 0 || strcmp(s, "1") == 0; }
 
+static struct timespec loaded_mtimes[2]; /* of the system and user config at the last load_config() */
+
+int config_changed(void) {
+    int i;
+    struct timespec mtimes[2];
+
+    config_mtimes(mtimes);
+    for (i = 0; i < 2; i++)
+        if (mtimes[i].tv_sec != loaded_mtimes[i].tv_sec || mtimes[i].tv_nsec != loaded_mtimes[i].tv_nsec)
+            return 1;
+    return 0;
+}
+
+void config_loaded_mtimes(struct timespec mtimes[2]) {
+    mtimes[0] = loaded_mtimes[0];
+    mtimes[1] = loaded_mtimes[1];
+}
+
+void config_mtimes(struct timespec mtimes[2]) {
+    int i;
+    char *paths[2];
+    struct stat filestats;
+
+    /* missing files are recorded as 0, so creating or removing them counts as a change */
+    paths[0] = system_config_path("pademelon.conf");
+    paths[1] = user_config_path("pademelon.conf");
+    for (i = 0; i < 2; i++) {
+        mtimes[i].tv_sec = mtimes[i].tv_nsec = 0;
+        if (paths[i] && stat(paths[i], &filestats) == 0)
+            mtimes[i] = filestats.st_mtim;
+        free(paths[i]);
+    }
+}
+
 
 void free_config(struct config *cfg) {
     free(cfg->keyboard_settings);
@@ -43,6 +79,22 @@ int ini_config_callback(void* user, const char* section, const char* name, const
             *write_to_int = IS_TRUE(value);
             return 1;
         }
+
+        /* integer attributes */
+        if (strcmp(name, "startup-jobs") == 0) {
+            if (!str_to_int(value, &cfg->startup_jobs) || cfg->startup_jobs < 1) {
+                fprintf(stderr, "WARNING: Invalid value for '%s': '%s'\n", name, value);
+                cfg->startup_jobs = DEFAULT_STARTUP_JOBS;
+            }
+            return 1;
+        }
+        if (strcmp(name, "shutdown-timeout") == 0) {
+            if (!str_to_int(value, &cfg->shutdown_timeout) || cfg->shutdown_timeout < 0) {
+                fprintf(stderr, "WARNING: Invalid value for '%s': '%s'\n", name, value);
+                cfg->shutdown_timeout = DEFAULT_SHUTDOWN_TIMEOUT;
+            }
+            return 1;
+        }
     } else if (strcmp(section, CONFIG_SECTION_APPLICATIONS) == 0) {
         c = find_category(name);
         if (c && strcmp(CONFIG_SECTION_APPLICATIONS, c->section) == 0) {
@@ -52,6 +104,14 @@ int ini_config_callback(void* user, const char* section, const char* name, const
             strcpy(c->user_preference, value);
             return 1;
         }
+    } else if (strcmp(section, CONFIG_SECTION_RESTART) == 0) {
+        c = find_category(name);
+        if (c && strcmp(CONFIG_SECTION_DAEMONS, c->section) == 0) {
+            c->restart = parse_restart_policy(value, strlen(value));
+            if (c->restart == RestartUnset)
+                fprintf(stderr, "WARNING: Invalid value for '%s': '%s'\n", name, value);
+            return 1;
+        }
     } else if (strcmp(section, CONFIG_SECTION_INPUT) == 0) {
         if (strcmp(name, "keyboard-layout") == 0) {
             write_to_str = &cfg->keyboard_settings;
@@ -99,6 +159,8 @@ struct config *load_config(void) {
     cfg->filemanager            = find_category("filemanager");
     cfg->terminal               = find_category("terminal");
 
+    /* taken before parsing, so changes made while parsing are picked up next time */
+    config_mtimes(loaded_mtimes);
     path = system_config_path("pademelon.conf");
     if (path) {
         status = ini_parse(path, &ini_config_callback, cfg);
@@ -118,9 +180,13 @@ struct config *load_config(void) {
 }
 
 int print_config(struct config *cfg) {
+    struct dcategory *c;
+
     /* CONFIG_SECTION_DAEMONS */
     PRINT_SECTION(CONFIG_SECTION_DAEMONS)
     PRINT_PROPERTY_BOOL("no-window-manager", cfg->no_window_manager);
+    PRINT_PROPERTY_INT("startup-jobs", cfg->startup_jobs);
+    PRINT_PROPERTY_INT("shutdown-timeout", cfg->shutdown_timeout);
     PRINT_PROPERTY_CAT(cfg->window_manager);
     PRINT_PROPERTY_CAT(cfg->compositor_daemon);
     PRINT_PROPERTY_CAT(cfg->hotkey_daemon);
@@ -143,6 +209,11 @@ int print_config(struct config *cfg) {
     PRINT_SECTION(CONFIG_SECTION_INPUT);
     PRINT_PROPERTY_STR("keyboard-layout", cfg->keyboard_settings);
 
+    PRINT_SECTION(CONFIG_SECTION_RESTART);
+    for (c = get_categories(); c->name; c++)
+        if (c->restart != RestartUnset)
+            PRINT_PROPERTY_STR(c->name, restart_policy_name(c->restart));
+
     if (fflush(stdout) == EOF)
         return -1;
     return 0;
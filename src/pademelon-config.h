@@ -2,14 +2,21 @@
 #define H_PADEMELON_CONFIG
 
 #include <stddef.h>
+#include <time.h>
 
 #define CONFIG_SECTION_DAEMONS      "daemons"
 #define CONFIG_SECTION_APPLICATIONS "applications"
 #define CONFIG_SECTION_INPUT        "input"
+#define CONFIG_SECTION_RESTART      "restart"
+
+#define DEFAULT_STARTUP_JOBS        4
+#define DEFAULT_SHUTDOWN_TIMEOUT    3000 /* milliseconds */
 
 struct config {
     /* CONFIG_SECTION_DAEMONS */
     int no_window_manager;
+    int startup_jobs;
+    int shutdown_timeout;
     struct dcategory *window_manager;
     struct dcategory *compositor_daemon;
     struct dcategory *dock_daemon;
@@ -31,6 +38,12 @@ struct config {
     char *keyboard_settings;
 };
 
+/* returns 1 if a config file has been modified, created or removed since the last load_config() */
+int config_changed(void);
+/* mtimes of the system and user config file as of the last load_config(), 0 for missing files */
+void config_loaded_mtimes(struct timespec mtimes[2]);
+/* mtimes of the system and user config file on disk, 0 for missing files */
+void config_mtimes(struct timespec mtimes[2]);
 void free_config(struct config *cfg);
 int ini_config_callback(void* user, const char* section, const char* name, const char* value);
 struct config *init_config(void);
@@ -41,6 +54,8 @@ int print_config(struct config *cfg);
 static const struct config default_config = {
     /* CONFIG_SECTION_DAEMONS */
     .no_window_manager = 0,
+    .startup_jobs = DEFAULT_STARTUP_JOBS,
+    .shutdown_timeout = DEFAULT_SHUTDOWN_TIMEOUT,
 };
 
 #endif /* H_PADEMELON_CONFIG */
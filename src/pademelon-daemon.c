@@ -1,6 +1,16 @@
+#ifdef PULSE
+#include "audio-control.h"
+#endif /* PULSE */
 #include "common.h"
+#include "control.h"
 #include "desktop-application.h"
+#include "desktop-files.h"
+#include "desktop-index.h"
+#include "events.h"
 #include "pademelon-config.h"
+#include "readiness.h"
+#include "scheduler.h"
+#include "session-state.h"
 #include "signals.h"
 #include "tools.h"
 #include <errno.h>
@@ -14,55 +24,311 @@
 
 #ifdef X11
 #include "x11-utils.h"
-#include <poll.h>
 #endif /* X11 */
 
 #ifdef LIBNOTIFY
 #include <libnotify/notify.h>
+#include <sys/epoll.h>
 #endif /* LIBNOTIFY */
 
 
-#define CYCLE_TIMEOUT               2   /* seconds */
-#define CYCLE_TIMEOUT_X11           10   /* seconds */
 #define SECS_TO_WALLPAPER_REFRESH   5   /* seconds, bigger than CYCLE_LENGTH */
-#define TIMEOUT_AFTER_WM_START      0   /* seconds */
+#define TIMEOUT_WM_START            5000    /* milliseconds, waiting for the window manager to take over */
+#define DAEMON_CATEGORIES           9
 #define NOTIFICATION_RESTART_ID     "restart"
 #define NOTIFICATION_IGNORE_ID      "ignore"
 #define NOTIFICATION_RESTART_LABEL  "Restart"
 #define NOTIFICATION_IGNORE_LABEL   "Ignore"
-
+#define NOTIFICATION_BATCH_WINDOW   500     /* milliseconds, terminations within are shown together */
+#define NOTIFICATION_QUEUE_SIZE     8       /* terminations listed in one notification */
+#define NOTIFICATION_RATE_LIMIT     30      /* seconds between notifications about the same application */
+#define NOTIFICATION_RATE_SLOTS     64      /* power of two */
+#define RESTART_DELAY_MIN           500     /* milliseconds */
+#define RESTART_DELAY_MAX           30000   /* milliseconds */
+#define RESTART_BURST               5       /* failures in a row before giving up */
+#define RESTART_WINDOW              10      /* seconds, daemons running longer are considered healthy */
+
+struct termination { /* queued for the next notification */
+    char id[64]; /* the application might be freed until the notification is shown */
+    pid_t pid;
+    const char *msg;
+    struct dcategory *category;
+};
+
+struct ratelimit {
+    unsigned int hash; /* of the application id */
+    time_t last; /* CLOCK_MONOTONIC seconds */
+};
+
+struct restart { /* automatic restart of a terminated daemon */
+    struct dapplication *application;
+    struct dcategory *category;
+    int timer; /* pending restart or -1 */
+    int failures; /* fast failures in a row */
+    int count; /* restarts so far */
+    int status; /* of the terminated process */
+    long delay; /* milliseconds */
+    struct restart *next;
+};
+
+enum controlaction {
+    ActionRestart, ActionStop, ActionReload,
+};
+
+struct deferred_action { /* control command run after its answer has been sent */
+    enum controlaction action;
+    struct dcategory *category; /* NULL to reload every category */
+};
+
+static void apply_overrides(void);
+static void control_action_handler(void *data);
+static void control_command(struct control_client *client, char *line);
+static void control_status(struct control_client *client);
+static void control_volume(struct control_client *client, char *value, char *option);
+static void defer_action(enum controlaction action, struct dcategory *c);
+static void dindex_handler(void *data);
+static void daemon_categories(struct dcategory *daemons[DAEMON_CATEGORIES + 1]);
 static void export_applications(void);
+static void forget_restarts(struct dcategory *c);
+#ifdef LIBNOTIFY
+static void glib_dispatch(void);
+static void glib_handler(void *data);
+static int glib_prepare(void);
+#endif /* LIBNOTIFY */
+static int launch_category(struct dcategory *c);
 static void launch_wm(void);
 static void load_keyboard(void);
 static void loop(void);
 static void notify_termination(struct dapplication *app, pid_t pid, char *msg);
 #ifdef LIBNOTIFY
-static void notification_callback(NotifyNotification *notification, char *action, gpointer user_data);
-static void notification_closed(NotifyNotification *notify, void *user_data);
+static void notification_callback(NotifyNotification *notify, char *action, gpointer user_data);
+static void notifications_show(void *data);
 #endif
-static unsigned int notifications_show(void);
+static void pidfd_handler(void *data);
+static void readiness_handler(void *data);
 void set_application(struct dcategory *c, const char *export_name);
 static void reload_config(void);
+static void reload_session(struct dcategory *only);
+static void restart_category(struct dcategory *c);
+static void restart_handler(void *data);
+static int schedule_restart(struct plist *pl);
 static void setup_signals(void);
-static void shutdown_daemons(void);
+static void sigchld_handler(int signal);
 static void sigint_handler(int signal);
 static void sigusr1_handler(int signal);
 static void sigusr2_handler(int signal);
 static void startup_daemons(void);
+static void stop_category(struct dcategory *c);
+static int unlink_launched(struct dapplication *a);
+static void unwatch_process(struct plist *pl);
+static void wait_wm(void);
+static void watch_process(struct plist *pl);
+#ifdef X11
+static void x11_handler(void *data);
+#endif /* X11 */
 
 static struct config *config;
 static int end = 0;
 static int ignore_wm_shutdown = 0;
 static int launch_setup = 0;
 static int no_wm_overwrite = 0;
+static const char *wm_override = NULL; /* --window-manager, outlives every reload of the config */
 static int reload = 0;
+static int state_changed = 1; /* the published session state is outdated */
+static struct restart *restarts = NULL;
+static struct dapplication *launched = NULL; /* applications launched on request, linked by next_optional */
 
 #ifdef LIBNOTIFY
-static NotifyNotification **notification_list;
-static unsigned int notification_list_size, remaining_notifications;
+static NotifyNotification *notification = NULL; /* reused, so a new summary replaces the old one */
+static struct termination terminations[NOTIFICATION_QUEUE_SIZE];
+static unsigned int nterminations = 0, dropped_terminations = 0;
+static struct ratelimit ratelimits[NOTIFICATION_RATE_SLOTS];
+static int notification_timer = -1;
+/* descriptors of the glib main context, watched by an epoll instance inside of the event loop */
+static int glib_epoll_fd = -1;
+static GPollFD *glib_fds = NULL;
+static gint glib_nfds = 0, glib_fds_size = 0, glib_priority;
 #endif /* LIBNOTIFY */
 
 
+void apply_overrides(void) {
+    struct dcategory *c = config->window_manager;
+
+    if (!wm_override)
+        return;
+    free(c->user_preference);
+    c->user_preference = strdup(wm_override);
+    if (!c->user_preference)
+        die("Unable to allocate memory for settings");
+}
+
+void control_action_handler(void *data) {
+    struct deferred_action *d = (struct deferred_action *) data;
+
+    switch (d->action) {
+        case ActionRestart:
+            DBGPRINT("Restarting category '%s' on request\n", d->category->name);
+            restart_category(d->category);
+            break;
+        case ActionStop:
+            DBGPRINT("Stopping category '%s' on request\n", d->category->name);
+            stop_category(d->category);
+            break;
+        case ActionReload:
+            reload_session(d->category);
+            break;
+    }
+    free(d);
+}
+
+void control_command(struct control_client *client, char *line) {
+    char *command, *argument, *saveptr = NULL;
+    struct dcategory *c = NULL;
+
+    command = strtok_r(line, " \t", &saveptr);
+    if (!command)
+        return;
+    argument = strtok_r(NULL, " \t", &saveptr);
+
+    /* the only command without a category argument */
+    if (strcmp(command, "volume") == 0) {
+        control_volume(client, argument, strtok_r(NULL, " \t", &saveptr));
+        return;
+    }
+
+    if (argument && !(c = find_category(argument))) {
+        control_reply(client, "ERROR unknown category '%s'\n", argument);
+        return;
+    }
+
+    /* applications are launched on request, only daemons are managed */
+    if (strcmp(command, "launch") == 0 && c && strcmp(c->section, CONFIG_SECTION_APPLICATIONS) == 0) {
+        /* an edited preference has to take effect without a reload, running daemons are left alone */
+        if (config_changed()) {
+            reload_config();
+            state_changed = 1;
+        }
+        if (!launch_category(c)) {
+            control_reply(client, "ERROR no suitable application found\n");
+            return;
+        }
+    } else if (c && strcmp(c->section, CONFIG_SECTION_DAEMONS) != 0) {
+        control_reply(client, "ERROR '%s' is not a daemon category\n", argument);
+        return;
+    } else if (strcmp(command, "status") == 0 && !c) {
+        control_status(client);
+    } else if (strcmp(command, "restart") == 0 && c) {
+        if (c == config->window_manager && launch_setup) {
+            control_reply(client, "ERROR the window manager cannot be restarted during setup\n");
+            return;
+        }
+        defer_action(ActionRestart, c);
+    } else if (strcmp(command, "stop") == 0 && c) {
+        if (c == config->window_manager) {
+            control_reply(client, "ERROR the window manager cannot be stopped\n");
+            return;
+        }
+        defer_action(ActionStop, c);
+    } else if (strcmp(command, "reload") == 0) {
+        defer_action(ActionReload, c);
+    } else {
+        control_reply(client, "ERROR usage: status | launch <category> | restart <category> | stop <category>"
+                " | reload [<category>] | volume <[+-]percentage> [quiet]\n");
+        return;
+    }
+    control_reply(client, "OK\n");
+}
+
+void control_status(struct control_client *client) {
+    char status[32];
+    time_t started;
+    struct dapplication *a;
+    struct dcategory *c;
+    struct plist *pl;
+    struct timespec now, realtime;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1 || clock_gettime(CLOCK_REALTIME, &realtime) == -1) {
+        control_reply(client, "ERROR unable to read clock\n");
+        return;
+    }
+
+    /* pid, category, application, start time, restarts and the status of the previous process */
+    for (pl = plist_peek(); pl; pl = pl->next) {
+        a = (struct dapplication *) pl->content;
+        c = find_owning_category(a);
+        started = realtime.tv_sec - (now.tv_sec - pl->started.tv_sec);
+
+        if (pl->restarts == 0)
+            snprintf(status, sizeof(status), "-");
+        else if (WIFEXITED(pl->last_status))
+            snprintf(status, sizeof(status), "exited:%d", WEXITSTATUS(pl->last_status));
+        else if (WIFSIGNALED(pl->last_status))
+            snprintf(status, sizeof(status), "signal:%d", WTERMSIG(pl->last_status));
+        else
+            snprintf(status, sizeof(status), "unknown");
+
+        control_reply(client, "%d\t%s\t%s\t%lld\t%d\t%s\n", pl->pid, c ? c->name : "-", a->id_name,
+                (long long) started, pl->restarts, status);
+    }
+}
+
+void control_volume(struct control_client *client, char *value, char *option) {
+#ifdef PULSE
+    int percentage, status;
+
+    if (!value || !str_to_int(value, &percentage) || (option && strcmp(option, "quiet") != 0)) {
+        control_reply(client, "ERROR usage: volume <[+-]percentage> [quiet]\n");
+        return;
+    }
+
+    /* relative changes are merged with the ones of other clients, so key repeats do not queue up */
+    if (value[0] == '+' || value[0] == '-')
+        status = audio_change_volume(percentage, !option);
+    else
+        status = audio_set_volume(percentage);
+    control_reply(client, status ? "OK\n" : "ERROR unable to change the volume\n");
+#else /* PULSE */
+    (void) value;
+    (void) option;
+    control_reply(client, "ERROR volume control requires libpulse\n");
+#endif /* PULSE */
+}
+
+void daemon_categories(struct dcategory *daemons[DAEMON_CATEGORIES + 1]) {
+    /* daemons */
+    daemons[0] = config->compositor_daemon;
+    daemons[1] = config->dock_daemon;
+    daemons[2] = config->hotkey_daemon;
+    daemons[3] = config->notification_daemon;
+    daemons[4] = config->polkit_daemon;
+    daemons[5] = config->power_daemon;
+    daemons[6] = config->status_daemon;
+    /* optional daemons */
+    daemons[7] = config->applets;
+    daemons[8] = config->optional;
+    daemons[DAEMON_CATEGORIES] = NULL;
+}
+
+void defer_action(enum controlaction action, struct dcategory *c) {
+    /* stopping and starting can take seconds, so answer the client first */
+    struct deferred_action *d = malloc(sizeof(struct deferred_action));
+    if (!d)
+        die("Unable to allocate memory for control command");
+    d->action = action;
+    d->category = c;
+    if (events_add_timer(0, &control_action_handler, d) < 0) {
+        DBGPRINT("Unable to defer control command: %s\n", strerror(errno));
+        control_action_handler(d);
+    }
+}
+
+void dindex_handler(void *data) {
+    (void) data;
+    /* desktop entries have changed, which might change the selection */
+    dindex_process_events();
+    state_changed = 1;
+}
+
 void export_applications(void) {
     /* set default applications */
     set_application(config->browser, "BROWSER");
@@ -71,20 +337,116 @@ void export_applications(void) {
     set_application(config->terminal, "TERMINAL");
 }
 
+int launch_category(struct dcategory *c) {
+    struct dapplication *a;
+
+    /* the selection is resolved from the in-memory index and config */
+    a = select_application(c);
+    if (!a)
+        return 0;
+    launch_application(a);
+    if (!plist_get_content(a)) {
+        free_application(a);
+        return 0;
+    }
+
+    /* kept until the process has terminated */
+    a->next_optional = launched;
+    launched = a;
+    state_changed = 1;
+    return 1;
+}
+
 static void launch_wm(void) {
     /* start window manager */
     if (launch_setup) {
         char *args[] = { "/bin/sh", "-c", "pademelon-settings", NULL };
+        reset_signal_mask();
         execvp(args[0], args);
         exit(EXIT_FAILURE);
     } else if (!config->no_window_manager && !no_wm_overwrite) {
-        if (!startup_daemon(config->window_manager)) {
+        /* the daemons are started right away, unless the window manager signals readiness */
+        schedule_startup((struct dcategory *[]) { config->window_manager, NULL }, 1);
+        if (!config->window_manager->active_application) {
             fprintf(stderr, "No window manager found\n");
             exit(1);
         }
     }
 }
 
+void forget_restarts(struct dcategory *c) {
+    struct restart **link, *r;
+
+    /* cancel pending restarts of c (or all categories) before its applications are freed */
+    for (link = &restarts; *link; ) {
+        r = *link;
+        if (c && r->category != c) {
+            link = &r->next;
+            continue;
+        }
+        if (r->timer >= 0)
+            events_remove(r->timer);
+        *link = r->next;
+        free(r);
+    }
+}
+
+#ifdef LIBNOTIFY
+void glib_dispatch(void) {
+    GMainContext *context = g_main_context_default();
+
+    /* the epoll instance only tells us that something has happened, not what */
+    if (glib_nfds > 0 && g_poll(glib_fds, (guint) glib_nfds, 0) < 0)
+        DBGPRINT("Unable to poll glib descriptors: %s\n", strerror(errno));
+    if (g_main_context_check(context, glib_priority, glib_fds, glib_nfds))
+        g_main_context_dispatch(context);
+    g_main_context_release(context);
+}
+
+void glib_handler(void *data) {
+    (void) data;
+    /* only wakes up the loop, glib_dispatch() does the work */
+}
+
+int glib_prepare(void) {
+    gint i, timeout;
+    gboolean ready;
+    GPollFD *temp;
+    GMainContext *context = g_main_context_default();
+    struct epoll_event ev = { 0 };
+
+    if (glib_epoll_fd < 0) {
+        glib_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (glib_epoll_fd < 0 || !events_add(glib_epoll_fd, &glib_handler, NULL))
+            die("Unable to watch glib main context");
+    }
+
+    g_main_context_acquire(context);
+    ready = g_main_context_prepare(context, &glib_priority);
+
+    /* the descriptors may change with every iteration, so start over */
+    for (i = 0; i < glib_nfds; i++)
+        epoll_ctl(glib_epoll_fd, EPOLL_CTL_DEL, glib_fds[i].fd, NULL);
+    while ((glib_nfds = g_main_context_query(context, glib_priority, &timeout, glib_fds, glib_fds_size))
+            > glib_fds_size) {
+        temp = realloc(glib_fds, sizeof(GPollFD) * (size_t) glib_nfds);
+        if (!temp)
+            die("Unable to allocate memory for glib descriptors");
+        glib_fds = temp;
+        glib_fds_size = glib_nfds;
+    }
+    for (i = 0; i < glib_nfds; i++) {
+        /* G_IO_* and EPOLL* flags share the values of their poll() counterparts */
+        ev.events = glib_fds[i].events;
+        ev.data.fd = glib_fds[i].fd;
+        if (epoll_ctl(glib_epoll_fd, EPOLL_CTL_ADD, glib_fds[i].fd, &ev) == -1 && errno != EEXIST)
+            DBGPRINT("Unable to watch glib descriptor: %s\n", strerror(errno));
+    }
+    /* do not sleep if a source is ready already */
+    return ready ? 0 : timeout;
+}
+#endif /* LIBNOTIFY */
+
 void load_keyboard(void) {
     if (config->keyboard_settings) {
         char temp[sizeof("setxkbmap ") + strlen(config->keyboard_settings) + 1];
@@ -95,17 +457,31 @@ void load_keyboard(void) {
 }
 
 void loop(void) {
+    int status;
+    struct dapplication *app;
     struct plist *pl;
 
+    /* nothing to do if there is no index */
+    events_add(dindex_fd(), &dindex_handler, NULL);
+    events_add(readiness_fd(), &readiness_handler, NULL);
+    control_init(&control_command);
 #ifdef X11
-    struct pollfd fds = {0};
-    int poll_status = 0;
-    fds.fd = x11_connection_number();
-    fds.events = POLLIN;
+    events_add(x11_connection_number(), &x11_handler, NULL);
 #endif /* X11 */
 
     while (!end) {
-        while ((pl = plist_next_event(NULL)) != NULL) {
+        while ((pl = plist_next_event()) != NULL) {
+            state_changed = 1;
+            if ((WIFEXITED(pl->status) || WIFSIGNALED(pl->status)) && unlink_launched(pl->content)) {
+                /* applications launched on request are expected to terminate */
+                DBGPRINT("Application '%s' (pid: %d) has terminated\n", ((struct dapplication*) pl->content)->id_name, pl->pid);
+                app = (struct dapplication *) pl->content;
+                /* the index of the plist refers to the application */
+                plist_remove(pl->pid);
+                free_application(app);
+                continue;
+            }
+
             if (WIFEXITED(pl->status)|| WIFSIGNALED(pl->status)) {
                 if (((struct dapplication*) pl->content)
                         && strcmp(((struct dapplication*) pl->content)->category->name, "window-manager") == 0) {
@@ -120,11 +496,13 @@ void loop(void) {
 
             if (WIFEXITED(pl->status)) {
                 DBGPRINT("Process '%s' (pid: %d) exited with return code %d\n", ((struct dapplication*) pl->content)->id_name, pl->pid, WEXITSTATUS(pl->status));
-                notify_termination(((struct dapplication*) pl->content), pl->pid, "exited");
+                if (!schedule_restart(pl))
+                    notify_termination(((struct dapplication*) pl->content), pl->pid, "exited");
                 plist_remove(pl->pid);
             } else if (WIFSIGNALED(pl->status)) {
                 DBGPRINT("Process '%s' (pid: %d) was terminated by signal %d\n", ((struct dapplication*) pl->content)->id_name, pl->pid, WTERMSIG(pl->status));
-                notify_termination(((struct dapplication*) pl->content), pl->pid, "was terminated by a signal");
+                if (!schedule_restart(pl))
+                    notify_termination(((struct dapplication*) pl->content), pl->pid, "was terminated by a signal");
                 plist_remove(pl->pid);
             } else if (WIFSTOPPED(pl->status)) {
                 DBGPRINT("Process '%s' (pid: %d) was stopped by signal %d\n", ((struct dapplication*) pl->content)->id_name, pl->pid, WSTOPSIG(pl->status));
@@ -144,140 +522,152 @@ void loop(void) {
             DBGPRINT("%s\n", "Keyboard configuration has changed");
             load_keyboard();
         }
+
+        /* replies waited for above might have queued further events, which epoll would not see */
+        if (x11_pending())
+            continue;
 #endif /* X11 */
 
         if (reload) {
             reload = 0;
-            /* ignore_wm_shutdown = 1; */
-
-            reload_config();
-            shutdown_daemons();
-            shutdown_daemon(config->window_manager);
-
-            /* remove wm from plist, so it pademelon does not exit */
-            pl = plist_search(NULL, config->window_manager->name);
-            if (pl)
-                plist_remove(pl->pid);
-
-            export_applications();
-            launch_wm();
-            sleep(TIMEOUT_AFTER_WM_START);
-            startup_daemons();
-
-            load_keyboard();
-            tl_load_wallpaper();
+            reload_session(NULL);
+            /* children reaped during the restart have to be handled before sleeping again */
+            continue;
         }
 
-        if (end || notifications_show()) {
+        if (end)
             continue;
-        }
 
-#ifdef X11
-        poll_status = poll(&fds, 1, CYCLE_TIMEOUT_X11 * 1000);
-        if (poll_status < 0) { /* error or signal */
-            if (errno != EINTR) {
-                DBGPRINT("Quitting because of poll error\n");
-                end = 1;
-            }
+        /* published once per wake up, however many processes have changed */
+        if (state_changed) {
+            state_changed = 0;
+            sstate_publish();
         }
-#else /* X11 */
-        sleep(CYCLE_TIMEOUT);
-#endif /* X11 */
 
+        /* sleep until a signal, a desktop entry change, an X11 or a notification event arrives */
+#ifdef LIBNOTIFY
+        status = events_dispatch(glib_prepare());
+        glib_dispatch();
+#else /* LIBNOTIFY */
+        status = events_dispatch(-1);
+#endif /* LIBNOTIFY */
+        if (status < 0) {
+            DBGPRINT("Quitting because of event loop error: %s\n", strerror(errno));
+            end = 1;
+        }
     }
 }
 
 void notify_termination(struct dapplication *app, pid_t pid, char *msg) {
 #ifdef LIBNOTIFY
-    int status;
-    char title[] = "A process has terminated";
-    char content_format[] = "Process '%s' (pid: %d) %s";
-    char content[strlen(content_format) + strlen(app->id_name) + strlen("really long pid") + strlen(msg) + 1 ];
-    NotifyNotification *notification;
-    NotifyNotification **temp;
-
-    status = snprintf(content, sizeof(content) / sizeof(char), content_format, app->id_name, pid, msg);
-    if (status < 0) {
-        DBGPRINT("snprintf failed: %s\n", strerror(errno));
-        return;
+    unsigned int h = 5381;
+    const char *p;
+    struct timespec now;
+    struct ratelimit *limit;
+    struct termination *t;
+
+    /* every application is reported at most once per NOTIFICATION_RATE_LIMIT */
+    for (p = app->id_name; *p; p++)
+        h = h * 33 + (unsigned char) *p;
+    limit = &ratelimits[h & (NOTIFICATION_RATE_SLOTS - 1)];
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+        if (limit->hash == h && limit->last && now.tv_sec - limit->last < NOTIFICATION_RATE_LIMIT) {
+            DBGPRINT("Not notifying about '%s' again\n", app->id_name);
+            return;
+        }
+        limit->hash = h;
+        limit->last = now.tv_sec;
     }
 
-    notification = notify_notification_new(title, content, "dialog-information");
-    notify_notification_add_action(notification, NOTIFICATION_RESTART_ID,  NOTIFICATION_RESTART_LABEL,
-            notification_callback, (void *) app, NULL);
-    notify_notification_add_action(notification, NOTIFICATION_IGNORE_ID, NOTIFICATION_IGNORE_LABEL,
-            notification_callback, (void *) app, NULL);
-
-    /* add notification to list */
-    temp = realloc(notification_list, sizeof(notification) * (notification_list_size + 1));
-    if (!temp) {
-        DBGPRINT("Unable to insert notification into list: %s\n", strerror(errno));
-        g_object_unref(G_OBJECT(notification));
+    /* the queue is bounded, further terminations are only counted */
+    if (nterminations < NOTIFICATION_QUEUE_SIZE) {
+        t = &terminations[nterminations++];
+        snprintf(t->id, sizeof(t->id), "%s", app->id_name);
+        t->pid = pid;
+        t->msg = msg;
+        t->category = find_owning_category(app);
     } else {
-        notification_list = temp;
-        notification_list[notification_list_size] = notification;
-        notification_list_size++;
+        dropped_terminations++;
     }
+
+    /* terminations within a short window are shown as one notification */
+    if (notification_timer < 0)
+        notification_timer = events_add_timer(NOTIFICATION_BATCH_WINDOW, &notifications_show, NULL);
+    if (notification_timer < 0)
+        notifications_show(NULL);
 #else /* LIBNOTIFY */
     return;
 #endif /* LIBNOTIFY */
 }
 
 #ifdef LIBNOTIFY
-void notification_callback(NotifyNotification *notification, char *action, void *user_data) {
-    struct dapplication *app = (struct dapplication *) user_data;
+void notification_callback(NotifyNotification *notify, char *action, void *user_data) {
+    struct dcategory **c = (struct dcategory **) user_data;
 
-    if (strcmp(action, NOTIFICATION_RESTART_ID) == 0
-            && app && app->category) {
-        DBGPRINT("Restarting application for %s\n", app->category->name);
-        shutdown_daemon(app->category);
-        startup_daemon(app->category);
+    if (strcmp(action, NOTIFICATION_RESTART_ID) != 0 || !c || end)
+        return;
+
+    for (; *c; c++) {
+        DBGPRINT("Restarting application for %s\n", (*c)->name);
+        restart_category(*c);
     }
 }
 
-void notification_closed(NotifyNotification *notify, void *user_data) {
-    int i;
-    GMainLoop *loop = (GMainLoop *) user_data;
-
-    remaining_notifications--;
-
-    if (remaining_notifications == 0) {
-        g_main_loop_quit(loop);
-        g_main_loop_unref(loop);
+void notifications_show(void *data) {
+    unsigned int i, k, ncategories = 0;
+    size_t len = 0;
+    int status;
+    char title[64], body[NOTIFICATION_QUEUE_SIZE * 128 + 32];
+    struct dcategory **categories;
 
-        for (i = 0; i < notification_list_size; i++) {
-            g_object_unref(G_OBJECT(notification_list[i]));
-        }
+    (void) data;
+    notification_timer = -1;
+    if (nterminations == 0)
+        return;
 
-        notification_list_size = 0;
-        free(notification_list);
-        notification_list = NULL;
+    if (nterminations + dropped_terminations == 1)
+        snprintf(title, sizeof(title), "A process has terminated");
+    else
+        snprintf(title, sizeof(title), "%u processes have terminated", nterminations + dropped_terminations);
+
+    /* the restart action covers all categories of the summary (freed with the action) */
+    categories = calloc(nterminations + 1, sizeof(struct dcategory *));
+    if (!categories)
+        die("Unable to allocate memory for notification");
+
+    for (i = 0; i < nterminations; i++) {
+        status = snprintf(body + len, sizeof(body) - len, "%sProcess '%s' (pid: %d) %s", i ? "\n" : "",
+                terminations[i].id, terminations[i].pid, terminations[i].msg);
+        if (status > 0)
+            len += (size_t) status;
+        if (len >= sizeof(body))
+            break; /* truncated */
+
+        for (k = 0; k < ncategories && categories[k] != terminations[i].category; k++);
+        if (k == ncategories && terminations[i].category)
+            categories[ncategories++] = terminations[i].category;
     }
-}
-#endif /* LIBNOTIFY */
+    if (dropped_terminations > 0 && len < sizeof(body))
+        snprintf(body + len, sizeof(body) - len, "\nand %u more", dropped_terminations);
+    nterminations = 0;
+    dropped_terminations = 0;
 
-static unsigned int notifications_show(void) {
-#ifdef LIBNOTIFY
-    int i;
-    unsigned int notifications_shown;
-    GMainLoop *loop = NULL;
-
-    notifications_shown = notification_list_size;
-    if (notification_list_size > 0) {
-        loop = g_main_loop_new (NULL, FALSE);
-        for (i = 0; i < notification_list_size; i++) {
-            g_signal_connect(G_OBJECT(notification_list[i]), "closed", G_CALLBACK(notification_closed), (void *) loop);
-            notify_notification_show(notification_list[i], NULL);
-        }
-        remaining_notifications = notification_list_size;
-        g_main_loop_run(loop);
+    if (!notification) {
+        notification = notify_notification_new(title, body, "dialog-information");
+    } else {
+        notify_notification_update(notification, title, body, "dialog-information");
+        notify_notification_clear_actions(notification);
     }
+    notify_notification_add_action(notification, NOTIFICATION_RESTART_ID, NOTIFICATION_RESTART_LABEL,
+            notification_callback, (void *) categories, free);
+    notify_notification_add_action(notification, NOTIFICATION_IGNORE_ID, NOTIFICATION_IGNORE_LABEL,
+            notification_callback, NULL, NULL);
 
-    return notifications_shown;
-#else /* LIBNOTIFY */
-    return 0;
-#endif /* LIBNOTIFY */
+    /* actions are handled asynchronously by glib_dispatch() */
+    if (!notify_notification_show(notification, NULL))
+        DBGPRINT("%s\n", "Unable to show notification");
 }
+#endif /* LIBNOTIFY */
 
 void set_application(struct dcategory *c, const char *export_name) {
     struct dapplication *app;
@@ -290,74 +680,219 @@ void set_application(struct dcategory *c, const char *export_name) {
 
     else if (test_application(app))
         export_application(app, export_name);
+    free_application(app);
+}
+
+void pidfd_handler(void *data) {
+    struct plist *pl = (struct plist *) data;
+
+    /* the process record is removed by the main loop */
+    if (plist_reap_process(pl))
+        events_remove(pl->pidfd);
 }
 
 void reload_config(void) {
     struct config *new_config;
+    struct dcategory *c;
+    /* pick up newly installed applications */
+    clear_executable_cache();
+    dindex_rewatch();
+
+    /* forget the old preferences, so removed keys do not linger */
+    for (c = get_categories(); c->name; c++) {
+        free(c->user_preference);
+        c->user_preference = NULL;
+        c->restart = RestartUnset;
+    }
+
     new_config = load_config();
     if (new_config) {
         free(config);
         config = new_config;
     }
+    apply_overrides();
+}
+
+void readiness_handler(void *data) {
+    (void) data;
+    /* late notifications and status updates must not fill up the socket */
+    if (readiness_process_messages() > 0)
+        state_changed = 1;
+}
+
+void restart_category(struct dcategory *c) {
+    /* a manual restart also resets the back off of automatic restarts */
+    stop_category(c);
+    if (c == config->window_manager) {
+        launch_wm();
+        wait_wm();
+    } else {
+        schedule_startup((struct dcategory *[]) { c, NULL }, config->startup_jobs);
+    }
+}
+
+void restart_handler(void *data) {
+    struct restart *r = (struct restart *) data;
+    struct plist *pl;
+
+    r->timer = -1;
+    state_changed = 1;
+    launch_application(r->application);
+    if ((pl = plist_get_content(r->application))) {
+        pl->restarts = ++r->count;
+        pl->last_status = r->status;
+    }
+}
+
+void reload_session(struct dcategory *only) {
+    int i, nchanged = 0;
+    char *keyboard_settings;
+    struct dapplication *a;
+    struct dcategory *daemons[DAEMON_CATEGORIES + 1], *changed[DAEMON_CATEGORIES + 1];
+
+    keyboard_settings = config->keyboard_settings ? strdup(config->keyboard_settings) : NULL;
+    reload_config();
+
+    /* stop daemons whose application selection or command has changed */
+    daemon_categories(daemons);
+    for (i = 0; daemons[i]; i++) {
+        if (only && daemons[i] != only)
+            continue;
+        a = select_applications(daemons[i]);
+        if (!same_applications(a, daemons[i]->active_application)) {
+            DBGPRINT("Restarting daemons for category '%s'\n", daemons[i]->name);
+            changed[nchanged++] = daemons[i];
+        }
+        free_applications(a);
+    }
+    changed[nchanged] = NULL;
+
+    /* all changed categories are stopped at once */
+    schedule_shutdown(changed, config->shutdown_timeout);
+    for (i = 0; changed[i]; i++) {
+        forget_restarts(changed[i]);
+        free_applications(changed[i]->active_application);
+        changed[i]->active_application = NULL;
+    }
+
+    /* the window manager is only replaced if necessary, so windows are kept */
+    if ((!only || only == config->window_manager) && !launch_setup && !config->no_window_manager
+            && !no_wm_overwrite) {
+        a = select_application(config->window_manager);
+        if (!same_applications(a, config->window_manager->active_application)) {
+            DBGPRINT("Restarting window manager\n");
+            /* removed from plist, so pademelon does not exit */
+            schedule_shutdown((struct dcategory *[]) { config->window_manager, NULL }, config->shutdown_timeout);
+            free_applications(config->window_manager->active_application);
+            config->window_manager->active_application = NULL;
+            launch_wm();
+            wait_wm();
+        }
+        free_application(a);
+    }
+
+    /* update environment variables in place */
+    export_applications();
+    schedule_startup(changed, config->startup_jobs);
+
+    /* reloading a single category leaves the rest of the session alone */
+    if (!only && (keyboard_settings || config->keyboard_settings) && (!keyboard_settings
+                || !config->keyboard_settings || strcmp(keyboard_settings, config->keyboard_settings) != 0))
+        load_keyboard();
+    free(keyboard_settings);
+    if (!only)
+        tl_load_wallpaper();
+    state_changed = 1;
+}
+
+int schedule_restart(struct plist *pl) {
+    int failed;
+    enum restartpolicy policy;
+    struct dapplication *app = (struct dapplication *) pl->content;
+    struct dcategory *c;
+    struct restart *r;
+    struct timespec now;
+
+    c = find_owning_category(app);
+    if (end || !c || c == config->window_manager)
+        return 0;
+
+    /* the key in the desktop entry takes precedence over the config */
+    policy = app->restart != RestartUnset ? app->restart : c->restart;
+    failed = !WIFEXITED(pl->status) || WEXITSTATUS(pl->status) != 0;
+    if (policy != RestartAlways && (policy != RestartOnFailure || !failed))
+        return 0;
+
+    for (r = restarts; r && r->application != app; r = r->next);
+    if (!r) {
+        r = calloc(1, sizeof(struct restart));
+        if (!r)
+            die("Unable to allocate memory for restart");
+        r->application = app;
+        r->category = c;
+        r->timer = -1;
+        r->next = restarts;
+        restarts = r;
+    }
+
+    /* back off exponentially as long as the daemon keeps exiting shortly after its start */
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == 0 && now.tv_sec - pl->started.tv_sec >= RESTART_WINDOW) {
+        r->failures = 0;
+        r->delay = 0;
+    }
+    r->status = pl->status;
+    if (++r->failures > RESTART_BURST) {
+        /* the counter is kept, a healthy run or a manual restart resets it */
+        if (fprintf(stderr, "WARNING: '%s' keeps terminating, not restarting it anymore\n", app->id_name) < 0)
+            DBGPRINT("%s\n", "Unable to print to stderr");
+        return 0;
+    }
+    r->delay = r->delay ? r->delay * 2 : RESTART_DELAY_MIN;
+    if (r->delay > RESTART_DELAY_MAX)
+        r->delay = RESTART_DELAY_MAX;
+
+    if (r->timer >= 0)
+        events_remove(r->timer);
+    r->timer = events_add_timer(r->delay, &restart_handler, r);
+    if (r->timer < 0) {
+        DBGPRINT("Unable to schedule restart of '%s': %s\n", app->id_name, strerror(errno));
+        return 0;
+    }
+    if (fprintf(stderr, "Restarting '%s' in %ld ms\n", app->id_name, r->delay) < 0)
+        DBGPRINT("%s\n", "Unable to print to stderr");
+    return 1;
 }
 
 static void setup_signals(void) {
-	int status;
-	struct sigaction sigaction_sigint_handler = { .sa_handler = &sigint_handler, .sa_flags = SA_NODEFER|SA_RESTART};
-	struct sigaction sigaction_sigusr1_handler = { .sa_handler = &sigusr1_handler, .sa_flags = SA_NODEFER|SA_RESTART};
-	struct sigaction sigaction_sigusr2_handler = { .sa_handler = &sigusr2_handler, .sa_flags = SA_NODEFER|SA_RESTART};
-
-    /* handle SIGCHLD */
-    if (!install_plist_sigchld_handler())
-		die("Unable to install plist sigchld handler");
-
-    /* handle SIGINT */
-	status = sigfillset(&sigaction_sigint_handler.sa_mask); // @TODO do I have to block anything here?
-	if (status == -1)
-		die("Unable to clear out a sigset");
-	status = sigaction(SIGINT, &sigaction_sigint_handler, NULL);
-	if (status == -1)
-		die("Unable to install signal handler");
-	status = sigaction(SIGTERM, &sigaction_sigint_handler, NULL);
-	if (status == -1)
-		die("Unable to install signal handler");
-
-    /* handle SIGUSR1 */
-	status = sigfillset(&sigaction_sigusr1_handler.sa_mask); // @TODO do I have to block anything here?
-	if (status == -1)
-		die("Unable to clear out a sigset");
-	status = sigaction(SIGUSR1, &sigaction_sigusr1_handler, NULL);
-	if (status == -1)
-		die("Unable to install signal handler");
-
-    /* handle SIGUSR2 */
-	status = sigfillset(&sigaction_sigusr2_handler.sa_mask); // @TODO do I have to block anything here?
-	if (status == -1)
-		die("Unable to clear out a sigset");
-	status = sigaction(SIGUSR2, &sigaction_sigusr2_handler, NULL);
-	if (status == -1)
-		die("Unable to install signal handler");
-}
-
-void shutdown_daemons() {
-    /* shutdown daemons */
-    shutdown_daemon(config->compositor_daemon);
-    shutdown_daemon(config->dock_daemon);
-    shutdown_daemon(config->hotkey_daemon);
-    shutdown_daemon(config->notification_daemon);
-    shutdown_daemon(config->polkit_daemon);
-    shutdown_daemon(config->power_daemon);
-    shutdown_daemon(config->status_daemon);
-
-    /* shutdown optional daemons */
-    shutdown_optionals(config->applets);
-    shutdown_optionals(config->optional);
+    if (!events_init())
+        die("Unable to initialize event loop");
+
+    /* children are supervised with pidfds, SIGCHLD is only needed on older kernels */
+    if (!plist_use_pidfds(&watch_process, &unwatch_process)
+            && !events_add_signal(SIGCHLD, &sigchld_handler))
+        die("Unable to install signal handler");
+
+    /* signals are handled synchronously by the event loop */
+    if (!events_add_signal(SIGINT, &sigint_handler)
+            || !events_add_signal(SIGTERM, &sigint_handler)
+            || !events_add_signal(SIGUSR1, &sigusr1_handler)
+            || !events_add_signal(SIGUSR2, &sigusr2_handler))
+        die("Unable to install signal handler");
+}
+
+void sigchld_handler(int signal) {
+    if (signal != SIGCHLD) {
+        /* should not happen */
+        return;
+    }
+
+    plist_reap();
 }
 
 void sigint_handler(int signal) {
 	int errno_save = errno;
 
-	if (signal != SIGINT) {
+	if (signal != SIGINT && signal != SIGTERM) {
 		/* should not happen */
 		return;
 	}
@@ -391,21 +926,62 @@ void sigusr2_handler(int signal) {
 	errno = errno_save;
 }
 
+void stop_category(struct dcategory *c) {
+    forget_restarts(c);
+    schedule_shutdown((struct dcategory *[]) { c, NULL }, config->shutdown_timeout);
+    free_applications(c->active_application);
+    c->active_application = NULL;
+    state_changed = 1;
+}
+
 void startup_daemons() {
-    /* start daemons */
-    startup_daemon(config->compositor_daemon);
-    startup_daemon(config->dock_daemon);
-    startup_daemon(config->hotkey_daemon);
-    startup_daemon(config->notification_daemon);
-    startup_daemon(config->polkit_daemon);
-    startup_daemon(config->power_daemon);
-    startup_daemon(config->status_daemon);
+    struct dcategory *daemons[DAEMON_CATEGORIES + 1];
+
+    daemon_categories(daemons);
+    /* independent daemons are started in parallel */
+    schedule_startup(daemons, config->startup_jobs);
+}
+
+int unlink_launched(struct dapplication *a) {
+    struct dapplication **link;
+
+    for (link = &launched; *link && *link != a; link = &(*link)->next_optional);
+    if (!*link)
+        return 0;
+    *link = a->next_optional;
+    a->next_optional = NULL;
+    return 1;
+}
 
-    /* start optional daemons */
-    startup_optionals(config->applets);
-    startup_optionals(config->optional);
+void unwatch_process(struct plist *pl) {
+    events_remove(pl->pidfd);
 }
 
+void wait_wm(void) {
+#ifdef X11
+    struct dapplication *a = config->window_manager->active_application;
+    struct plist *pl;
+
+    /* window managers signaling readiness have already been waited for by the scheduler */
+    if (launch_setup || !a || (a->notify && readiness_fd() >= 0) || !(pl = plist_get_content(a)))
+        return;
+    if (!x11_wait_wm(TIMEOUT_WM_START, pl->pidfd))
+        DBGPRINT("Window manager '%s' has not taken over the screen\n", a->id_name);
+#endif /* X11 */
+}
+
+void watch_process(struct plist *pl) {
+    if (!events_add(pl->pidfd, &pidfd_handler, pl))
+        DBGPRINT("Unable to watch process %d: %s\n", pl->pid, strerror(errno));
+}
+
+#ifdef X11
+void x11_handler(void *data) {
+    (void) data;
+    /* only wakes up the loop, the events are checked there */
+}
+#endif /* X11 */
+
 int main(int argc, char *argv[]) {
     int i;
 
@@ -414,6 +990,12 @@ int main(int argc, char *argv[]) {
     /* load config */
     config = load_config();
 
+    /* keep desktop entries in memory and watch them for changes */
+    dindex_init(desktop_entry_dirs());
+
+    /* exported before anything is launched */
+    readiness_init();
+
     for (i = 1; argv[i]; i++) {
         if (strcmp(argv[i], "--no-window-manager") == 0 || strcmp(argv[i], "-n") == 0) {
             no_wm_overwrite = 1;
@@ -422,10 +1004,8 @@ int main(int argc, char *argv[]) {
         } else if (strcmp(argv[i], "--window-manager") == 0 || strcmp(argv[i], "-w") == 0) {
             if (!argv[i + 1])
                 die("Not enough arguments for --window-manager");
-            free(config->window_manager);
-            config->window_manager->user_preference = strdup(argv[++i]);
-            if (!config->window_manager)
-                die("Unable to allocate memory for settings");
+            wm_override = argv[++i];
+            apply_overrides();
         } else {
             if (printf("Usage: %s [--no-window-manager] [--window-manager <window-manager>] [--setup]\n", argv[0]) < 0)
                 die("Unable to write to stderr");
@@ -444,18 +1024,33 @@ int main(int argc, char *argv[]) {
 #ifdef LIBNOTIFY
     notify_init("Pademelon Daemon");
 #endif /* LIBNOTIFY */
-    sleep(TIMEOUT_AFTER_WM_START);
+    wait_wm();
     startup_daemons();
     loop();
 
-    shutdown_all_daemons();
+    forget_restarts(NULL);
+    schedule_shutdown(NULL, config->shutdown_timeout);
+    free_applications(launched);
 #ifdef LIBNOTIFY
+    if (notification)
+        g_object_unref(G_OBJECT(notification));
     notify_uninit();
+    if (glib_epoll_fd >= 0)
+        close(glib_epoll_fd);
+    free(glib_fds);
 #endif /* LIBNOTIFY */
 #ifdef X11
     x11_deinit();
 #endif /* X11 */
     plist_free();
+    events_free();
+    dindex_free();
+    sstate_remove();
+#ifdef PULSE
+    audio_free();
+#endif /* PULSE */
+    control_free();
+    readiness_free();
     free_config(config);
     free_categories();
 }
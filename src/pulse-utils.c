@@ -0,0 +1,228 @@
+#ifdef PULSE
+
+#include "common.h"
+#include "pulse-utils.h"
+#include "signals.h"
+#include <pulse/pulseaudio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define DEFAULT_SINK    "@DEFAULT_SINK@"
+#define DEFAULT_SOURCE  "@DEFAULT_SOURCE@"
+
+enum pulseaction {
+    PulseGetVolume, PulseChangeVolume, PulseSetVolume, PulseToggleMute,
+};
+
+struct pulse_request { /* filled in by the callbacks */
+    enum pulseaction action;
+    int value; /* volume change or new volume in percent */
+    int volume; /* resulting volume in percent */
+    int success;
+    int pending; /* operations started from a callback */
+};
+
+static int iterate(const struct timespec *deadline);
+static void sink_callback(pa_context *c, const pa_sink_info *info, int eol, void *userdata);
+static void source_callback(pa_context *c, const pa_source_info *info, int eol, void *userdata);
+static void started(struct pulse_request *r, pa_operation *o);
+static void success_callback(pa_context *c, int success, void *userdata);
+static pa_volume_t to_volume(int percentage);
+static int to_percentage(pa_volume_t volume);
+static int wait_for(struct pulse_request *r, pa_operation *o);
+
+static pa_mainloop *mainloop = NULL;
+static pa_context *context = NULL;
+
+
+int pulse_change_volume(int delta, int *volume) {
+    struct pulse_request r = { .action = PulseChangeVolume, .value = delta };
+
+    /* the new volume is set from the callback, so this takes a single round trip to the server */
+    if (!pulse_init()
+            || !wait_for(&r, pa_context_get_sink_info_by_name(context, DEFAULT_SINK, &sink_callback, &r)))
+        return 0;
+    if (volume)
+        *volume = r.volume;
+    return 1;
+}
+
+void pulse_deinit(void) {
+    if (context) {
+        pa_context_disconnect(context);
+        pa_context_unref(context);
+    }
+    if (mainloop)
+        pa_mainloop_free(mainloop);
+    context = NULL;
+    mainloop = NULL;
+}
+
+int iterate(const struct timespec *deadline) {
+    long remaining;
+    struct timespec now;
+
+    /* a single blocking iteration, but never past the deadline */
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        return 0;
+    remaining = (deadline->tv_sec - now.tv_sec) * 1000000L + (deadline->tv_nsec - now.tv_nsec) / 1000;
+    if (remaining <= 0) {
+        DBGPRINT("Sound server did not answer within %d ms\n", PULSE_TIMEOUT);
+        return 0;
+    }
+    return pa_mainloop_prepare(mainloop, (int) remaining) >= 0 && pa_mainloop_poll(mainloop) >= 0
+        && pa_mainloop_dispatch(mainloop) >= 0;
+}
+
+int pulse_get_volume(int *volume) {
+    struct pulse_request r = { .action = PulseGetVolume };
+
+    if (!pulse_init()
+            || !wait_for(&r, pa_context_get_sink_info_by_name(context, DEFAULT_SINK, &sink_callback, &r)))
+        return 0;
+    *volume = r.volume;
+    return 1;
+}
+
+int pulse_init(void) {
+    pa_context_state_t state;
+    struct timespec deadline;
+
+    if (context)
+        return 1;
+    if (!plist_deadline(&deadline, PULSE_TIMEOUT))
+        return 0;
+
+    mainloop = pa_mainloop_new();
+    if (!mainloop)
+        return 0;
+    context = pa_context_new(pa_mainloop_get_api(mainloop), PULSE_CLIENT_NAME);
+    if (!context || pa_context_connect(context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0)
+        goto error;
+
+    while ((state = pa_context_get_state(context)) != PA_CONTEXT_READY)
+        if (!PA_CONTEXT_IS_GOOD(state) || !iterate(&deadline))
+            goto error;
+    return 1;
+
+error:
+    DBGPRINT("Unable to connect to the sound server: %s\n",
+            context ? pa_strerror(pa_context_errno(context)) : "out of memory");
+    pulse_deinit();
+    return 0;
+}
+
+int pulse_set_mute(enum pulsedevice device, int mute) {
+    struct pulse_request r = { .action = PulseToggleMute };
+    pa_operation *o;
+
+    if (!pulse_init())
+        return 0;
+
+    /* toggling needs the current state, which is only known to the callback */
+    if (mute < 0 && device == PulseSink)
+        o = pa_context_get_sink_info_by_name(context, DEFAULT_SINK, &sink_callback, &r);
+    else if (mute < 0)
+        o = pa_context_get_source_info_by_name(context, DEFAULT_SOURCE, &source_callback, &r);
+    else if (device == PulseSink)
+        o = pa_context_set_sink_mute_by_name(context, DEFAULT_SINK, mute, &success_callback, &r);
+    else
+        o = pa_context_set_source_mute_by_name(context, DEFAULT_SOURCE, mute, &success_callback, &r);
+    if (mute >= 0 && o)
+        r.pending++;
+    return wait_for(&r, o);
+}
+
+int pulse_set_volume(int volume) {
+    struct pulse_request r = { .action = PulseSetVolume, .value = volume };
+
+    /* the channel volumes of the sink are needed to keep the balance */
+    return pulse_init()
+        && wait_for(&r, pa_context_get_sink_info_by_name(context, DEFAULT_SINK, &sink_callback, &r));
+}
+
+void sink_callback(pa_context *c, const pa_sink_info *info, int eol, void *userdata) {
+    int percentage;
+    pa_cvolume volume;
+    struct pulse_request *r = (struct pulse_request *) userdata;
+
+    if (eol || !info)
+        return;
+
+    percentage = to_percentage(pa_cvolume_max(&info->volume));
+    if (r->action == PulseGetVolume) {
+        r->volume = percentage;
+        r->success = 1;
+        return;
+    } else if (r->action == PulseToggleMute) {
+        started(r, pa_context_set_sink_mute_by_index(c, info->index, !info->mute, &success_callback, r));
+        return;
+    }
+
+    percentage = r->action == PulseChangeVolume ? percentage + r->value : r->value;
+    percentage = MIN_INT(percentage, 100);
+    percentage = MAX_INT(percentage, 0);
+    volume = info->volume;
+    pa_cvolume_scale(&volume, to_volume(percentage));
+    r->volume = percentage;
+    started(r, pa_context_set_sink_volume_by_index(c, info->index, &volume, &success_callback, r));
+}
+
+void source_callback(pa_context *c, const pa_source_info *info, int eol, void *userdata) {
+    struct pulse_request *r = (struct pulse_request *) userdata;
+
+    if (eol || !info)
+        return;
+    started(r, pa_context_set_source_mute_by_index(c, info->index, !info->mute, &success_callback, r));
+}
+
+void started(struct pulse_request *r, pa_operation *o) {
+    /* the operation is tracked by the pending counter */
+    if (!o)
+        return;
+    r->pending++;
+    pa_operation_unref(o);
+}
+
+void success_callback(pa_context *c, int success, void *userdata) {
+    struct pulse_request *r = (struct pulse_request *) userdata;
+
+    (void) c;
+    r->success = success;
+    r->pending--;
+}
+
+pa_volume_t to_volume(int percentage) {
+    return (pa_volume_t) ((uint64_t) percentage * PA_VOLUME_NORM / 100);
+}
+
+int to_percentage(pa_volume_t volume) {
+    return (int) (((uint64_t) volume * 100 + PA_VOLUME_NORM / 2) / PA_VOLUME_NORM);
+}
+
+int wait_for(struct pulse_request *r, pa_operation *o) {
+    struct timespec deadline;
+
+    if (!o)
+        return 0;
+    if (!plist_deadline(&deadline, PULSE_TIMEOUT)) {
+        pa_operation_unref(o);
+        pulse_deinit();
+        return 0;
+    }
+
+    /* operations started from callbacks share the deadline of the request */
+    while (pa_operation_get_state(o) == PA_OPERATION_RUNNING || r->pending > 0) {
+        if (!PA_CONTEXT_IS_GOOD(pa_context_get_state(context)) || !iterate(&deadline)) {
+            DBGPRINT("Request to the sound server failed: %s\n", pa_strerror(pa_context_errno(context)));
+            pa_operation_unref(o);
+            /* drops pending operations and their callbacks, which point to r, the next request reconnects */
+            pulse_deinit();
+            return 0;
+        }
+    }
+    pa_operation_unref(o);
+    return r->success;
+}
+
+#endif /* PULSE */
@@ -0,0 +1,28 @@
+#ifndef H_PULSE_UTILS
+#define H_PULSE_UTILS
+
+#define PULSE_CLIENT_NAME   "pademelon"
+#define PULSE_TIMEOUT       500 /* milliseconds for connecting and for every request */
+
+enum pulsedevice {
+    PulseSink, PulseSource,
+};
+
+/*
+ * synchronous volume control of the default sink and source on a single connection
+ *
+ * the server is chosen by libpulse (e.g. $PULSE_SERVER), which also works with pipewire-pulse
+ * volumes are in percent of the normal volume of the loudest channel, the balance is kept
+ * a server that does not answer within PULSE_TIMEOUT is disconnected, the next call reconnects
+ * all functions return 1 on success and 0 otherwise
+ */
+int pulse_init(void);
+void pulse_deinit(void);
+/* volume is set to the new volume if it is not NULL */
+int pulse_change_volume(int delta, int *volume);
+int pulse_get_volume(int *volume);
+/* mute is 1 to mute, 0 to unmute and -1 to toggle */
+int pulse_set_mute(enum pulsedevice device, int mute);
+int pulse_set_volume(int volume);
+
+#endif /* H_PULSE_UTILS */
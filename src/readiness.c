@@ -0,0 +1,185 @@
+#define _GNU_SOURCE /* struct ucred */
+#include "common.h"
+#include "desktop-application.h"
+#include "readiness.h"
+#include "signals.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static pid_t parent_pid(pid_t pid);
+static int process_message(char *message, pid_t sender);
+static struct plist *supervised_ancestor(pid_t pid);
+
+static int socket_fd = -1;
+static char *socket_path = NULL; /* NULL for abstract sockets */
+
+
+pid_t parent_pid(pid_t pid) {
+    FILE *file;
+    char path[sizeof("/proc//stat") + 3 * sizeof(pid_t)], buffer[512], *end;
+    int ppid;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    file = fopen(path, "r");
+    if (!file)
+        return 0;
+    end = fgets(buffer, sizeof(buffer), file);
+    fclose(file);
+    if (!end)
+        return 0;
+
+    /* the command name might contain spaces and parentheses, the state and ppid follow the last ')' */
+    end = strrchr(buffer, ')');
+    if (!end || sscanf(end + 1, " %*c %d", &ppid) != 1)
+        return 0;
+    return (pid_t) ppid;
+}
+
+int process_message(char *message, pid_t sender) {
+    int ready = 0, mainpid = 0;
+    char *line, *saveptr = NULL;
+    struct plist *pl;
+
+    for (line = strtok_r(message, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        if (strcmp(line, "READY=1") == 0)
+            ready = 1;
+        else if (STR_STARTS_WITH(line, "MAINPID=") && !str_to_int(line + strlen("MAINPID="), &mainpid))
+            mainpid = 0;
+        else if (STR_STARTS_WITH(line, "STATUS="))
+            DBGPRINT("Status of process %d: %s\n", sender, line + strlen("STATUS="));
+    }
+    if (!ready)
+        return 0;
+
+    /* helpers or forked children of a daemon might send the notification on its behalf */
+    pl = supervised_ancestor(sender);
+    if (!pl || pl->ready)
+        return 0;
+    /* MAINPID= must not let one process mark an unrelated one as ready */
+    if (mainpid > 0 && supervised_ancestor((pid_t) mainpid) != pl) {
+        DBGPRINT("Ignoring MAINPID=%d from process %d\n", mainpid, sender);
+        return 0;
+    }
+    DBGPRINT("Process '%s' (pid: %d) is ready\n", ((struct dapplication *) pl->content)->id_name, pl->pid);
+    pl->ready = 1;
+    return 1;
+}
+
+int readiness_fd(void) {
+    return socket_fd;
+}
+
+void readiness_free(void) {
+    if (socket_fd >= 0)
+        close(socket_fd);
+    if (socket_path)
+        unlink(socket_path);
+    free(socket_path);
+    socket_fd = -1;
+    socket_path = NULL;
+    set_notify_socket(NULL);
+}
+
+int readiness_init(void) {
+    int on = 1;
+    char *path;
+    char name[sizeof(READINESS_SOCKET_NAME) + 3 * sizeof(pid_t) + 1];
+    char value[sizeof(((struct sockaddr_un *) NULL)->sun_path) + 1];
+    socklen_t len;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (socket_fd >= 0)
+        return socket_fd;
+
+    socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (socket_fd == -1)
+        return -1;
+    /* the kernel attaches the credentials of the sender to every message */
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) == -1)
+        goto error;
+
+    /* several sessions of the same user must not share the socket */
+    snprintf(name, sizeof(name), "%s-%d", READINESS_SOCKET_NAME, getpid());
+    path = user_runtime_path(name);
+    if (path && strlen(path) < sizeof(addr.sun_path)) {
+        strcpy(addr.sun_path, path);
+        strcpy(value, path);
+        len = (socklen_t) sizeof(addr);
+        unlink(path);
+        socket_path = path;
+    } else {
+        /* without a runtime dir the abstract namespace is used, which sd_notify(3) marks with '@' */
+        free(path);
+        snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "pademelon/%s", name);
+        snprintf(value, sizeof(value), "@%s", addr.sun_path + 1);
+        len = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr.sun_path + 1));
+    }
+
+    if (bind(socket_fd, (struct sockaddr *) &addr, len) == -1)
+        goto error;
+    /* only passed to applications that signal readiness, it stays out of our own environment */
+    set_notify_socket(value);
+    return socket_fd;
+
+error:
+    DBGPRINT("Unable to create readiness socket: %s\n", strerror(errno));
+    readiness_free();
+    return -1;
+}
+
+int readiness_process_messages(void) {
+    int nready = 0;
+    ssize_t len;
+    pid_t sender;
+    char buffer[READINESS_MESSAGE_SIZE + 1];
+    struct iovec iov = { .iov_base = buffer, .iov_len = READINESS_MESSAGE_SIZE };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    struct cmsghdr *cmsg;
+    struct ucred cred;
+    union { /* aligned buffer for the credentials */
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(sizeof(struct ucred))];
+    } control;
+
+    if (socket_fd < 0)
+        return 0;
+
+    for (;;) {
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+        len = recvmsg(socket_fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                DBGPRINT("Unable to read readiness message: %s\n", strerror(errno));
+            break;
+        }
+        buffer[len] = '\0';
+
+        /* the socket might be reachable by other users (e.g. in the abstract namespace) */
+        sender = 0;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS) {
+                memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+                sender = cred.uid == getuid() ? cred.pid : 0;
+            }
+        }
+        if (sender > 0)
+            nready += process_message(buffer, sender);
+    }
+    return nready;
+}
+
+struct plist *supervised_ancestor(pid_t pid) {
+    int i;
+    struct plist *pl;
+
+    for (i = 0; i <= READINESS_MAX_ANCESTORS && pid > 1; i++, pid = parent_pid(pid))
+        if ((pl = plist_get(pid)))
+            return pl;
+    return NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef H_READINESS
+#define H_READINESS
+
+#define READINESS_SOCKET_NAME       "notify"
+#define READINESS_MESSAGE_SIZE      4096
+#define READINESS_MAX_ANCESTORS     4 /* parents of a sender searched for a supervised process */
+
+/*
+ * readiness channel compatible with sd_notify(3)
+ *
+ * a datagram socket is bound in the user runtime dir (or the abstract namespace) and passed as
+ * $NOTIFY_SOCKET to applications with X-Pademelon-Notify=true, so they can send READY=1 once they are
+ * ready to be used
+ * the sender is identified by its credentials and has to run as the same user, the supervised process
+ * it descends from is marked as ready (MAINPID= is only accepted if it points to the same process)
+ *
+ * returns the socket or -1 on error, in which case readiness is not tracked
+ */
+int readiness_init(void);
+void readiness_free(void);
+/* returns the socket or -1 if readiness is not tracked */
+int readiness_fd(void);
+/* read all pending messages without blocking, returns the number of processes that became ready */
+int readiness_process_messages(void);
+
+#endif /* H_READINESS */
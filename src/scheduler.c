@@ -0,0 +1,342 @@
+#include "common.h"
+#include "desktop-application.h"
+#include "readiness.h"
+#include "scheduler.h"
+#include "signals.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum jobstate {
+    JobWaiting, JobTesting, JobStarting, JobStopping, JobDone,
+};
+
+struct job {
+    enum jobstate state;
+    struct dapplication *application;
+    struct dcategory *category; /* category the job was scheduled for */
+    struct plist *process; /* launched process waiting for readiness or process to stop */
+    struct timespec deadline; /* readiness timeout */
+    struct dcategory *after[SCHEDULER_MAX_DEPENDENCIES];
+    int nafter;
+};
+
+static void add_job(struct job **jobs, int *njobs, struct dapplication *a, struct dcategory *c);
+static int check_starting(struct job *jobs, int njobs, struct plist **pending, struct timespec *deadline);
+static int collect_tests(struct job *jobs, struct dtest *tests, int njobs, int *running);
+static int dependencies_done(struct job *jobs, int njobs, struct job *j);
+static int dependents_done(struct job *jobs, int njobs, struct job *j);
+static int finish_job(struct job *j, int available);
+static void parse_dependencies(struct job *j);
+static int start_job(struct job *j, struct dtest *t, int *running);
+static void stop_job(struct job *j);
+
+
+void add_job(struct job **jobs, int *njobs, struct dapplication *a, struct dcategory *c) {
+    struct job *temp;
+
+    temp = realloc(*jobs, sizeof(struct job) * (size_t) (*njobs + 1));
+    if (!temp)
+        die("Unable to allocate memory for startup jobs");
+    *jobs = temp;
+
+    memset(&(*jobs)[*njobs], 0, sizeof(struct job));
+    (*jobs)[*njobs].application = a;
+    (*jobs)[*njobs].category = c;
+    parse_dependencies(&(*jobs)[*njobs]);
+    (*njobs)++;
+}
+
+int check_starting(struct job *jobs, int njobs, struct plist **pending, struct timespec *deadline) {
+    int i, npending = 0;
+    struct timespec now;
+
+    readiness_process_messages();
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        return 0;
+
+    /* dependents are started as soon as the process is ready, has terminated or has timed out */
+    for (i = 0; i < njobs; i++) {
+        if (jobs[i].state != JobStarting)
+            continue;
+        if (jobs[i].process->ready || jobs[i].process->status_changed) {
+            jobs[i].state = JobDone;
+            continue;
+        }
+        if (now.tv_sec > jobs[i].deadline.tv_sec
+                || (now.tv_sec == jobs[i].deadline.tv_sec && now.tv_nsec >= jobs[i].deadline.tv_nsec)) {
+            if (fprintf(stderr, "WARNING: Application '%s' did not signal readiness in time\n",
+                        jobs[i].application->id_name) < 0)
+                DBGPRINT("%s\n", "Unable to print to stderr");
+            jobs[i].state = JobDone;
+            continue;
+        }
+
+        if (npending == 0 || jobs[i].deadline.tv_sec < deadline->tv_sec
+                || (jobs[i].deadline.tv_sec == deadline->tv_sec && jobs[i].deadline.tv_nsec < deadline->tv_nsec))
+            *deadline = jobs[i].deadline;
+        pending[npending++] = jobs[i].process;
+    }
+    return npending;
+}
+
+int collect_tests(struct job *jobs, struct dtest *tests, int njobs, int *running) {
+    int i, launched = 0;
+
+    for (i = 0; i < njobs; i++) {
+        if (jobs[i].state != JobTesting || tests[i].state != TestFinished)
+            continue;
+        tests[i].state = TestIdle;
+        (*running)--;
+        launched += finish_job(&jobs[i], tests[i].available);
+    }
+    return launched;
+}
+
+int dependencies_done(struct job *jobs, int njobs, struct job *j) {
+    int i, k;
+
+    for (i = 0; i < j->nafter; i++) {
+        for (k = 0; k < njobs; k++) {
+            if (&jobs[k] != j && jobs[k].category == j->after[i] && jobs[k].state != JobDone)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+int dependents_done(struct job *jobs, int njobs, struct job *j) {
+    int i, k;
+
+    for (k = 0; k < njobs; k++) {
+        if (&jobs[k] == j || jobs[k].state == JobDone)
+            continue;
+        for (i = 0; i < jobs[k].nafter; i++)
+            if (jobs[k].after[i] == j->category)
+                return 0;
+    }
+    return 1;
+}
+
+int finish_job(struct job *j, int available) {
+    j->state = JobDone;
+    if (!available) {
+        DBGPRINT("Application '%s' is not available\n", j->application->id_name);
+        return 0;
+    }
+    launch_application(j->application);
+
+    /* without the readiness socket the notification would never arrive */
+    if (j->application->notify && readiness_fd() >= 0 && (j->process = plist_get_content(j->application))
+            && plist_deadline(&j->deadline, SCHEDULER_READY_TIMEOUT))
+        j->state = JobStarting;
+    return 1;
+}
+
+void parse_dependencies(struct job *j) {
+    char *s, *token, *saveptr = NULL;
+    struct dcategory *c;
+
+    if (!j->application->after)
+        return;
+
+    s = strdup(j->application->after);
+    if (!s)
+        die("Unable to allocate memory for startup dependencies");
+    for (token = strtok_r(s, ";", &saveptr); token; token = strtok_r(NULL, ";", &saveptr)) {
+        c = find_category(token);
+        if (!c) {
+            DBGPRINT("Unknown dependency '%s' for application '%s'\n", token, j->application->id_name);
+            continue;
+        }
+        if (j->nafter >= SCHEDULER_MAX_DEPENDENCIES) {
+            DBGPRINT("Too many dependencies for application '%s'\n", j->application->id_name);
+            break;
+        }
+        j->after[j->nafter++] = c;
+    }
+    free(s);
+}
+
+int schedule_startup(struct dcategory **categories, int max_jobs) {
+    int i, njobs = 0, running = 0, launched = 0, remaining, started, nstarting;
+    struct dapplication *a;
+    struct dcategory *c;
+    struct job *jobs = NULL;
+    struct dtest *tests;
+    struct timespec deadline;
+
+    if (!categories)
+        return 0;
+    if (max_jobs < 1)
+        max_jobs = 1;
+
+    /* resolve applications for all categories */
+    for (; *categories; categories++) {
+        c = *categories;
+        c->active_application = select_applications(c);
+        for (a = c->active_application; a; a = a->next_optional)
+            add_job(&jobs, &njobs, a, c);
+    }
+
+    tests = calloc((size_t) MAX_INT(njobs, 1), sizeof(struct dtest));
+    if (!tests)
+        die("Unable to allocate memory for startup jobs");
+    struct plist *starting[MAX_INT(njobs, 1)];
+
+    /* keep SIGCHLD pending, so the test processes can be reaped by test_wait() */
+    block_signal(SIGCHLD);
+
+    remaining = njobs;
+    while (remaining > 0) {
+        nstarting = check_starting(jobs, njobs, starting, &deadline);
+
+        /* start every job that is ready as long as there are free slots */
+        started = 0;
+        for (i = 0; i < njobs && running < max_jobs; i++) {
+            if (jobs[i].state != JobWaiting || !dependencies_done(jobs, njobs, &jobs[i]))
+                continue;
+            launched += start_job(&jobs[i], &tests[i], &running);
+            started = 1;
+        }
+
+        /* break dependency cycles by starting the first waiting job anyway */
+        if (!started && running == 0 && nstarting == 0) {
+            for (i = 0; i < njobs && jobs[i].state != JobWaiting; i++);
+            if (i < njobs) {
+                DBGPRINT("Dependency cycle detected, starting '%s' anyway\n", jobs[i].application->id_name);
+                launched += start_job(&jobs[i], &tests[i], &running);
+            }
+        }
+
+        /* readiness notifications wake us up as well */
+        if (running > 0) {
+            /* tests that cannot be waited for anymore count as failed, the remaining jobs still start */
+            if (test_wait(tests, njobs, readiness_fd()) < 0) {
+                DBGPRINT("Unable to wait for application tests: %s\n", strerror(errno));
+                test_abort(tests, njobs);
+            }
+            launched += collect_tests(jobs, tests, njobs, &running);
+        } else if (nstarting > 0) {
+            plist_wait_any(starting, nstarting, &deadline, readiness_fd());
+        }
+
+        for (i = 0, remaining = 0; i < njobs; i++)
+            if (jobs[i].state != JobDone)
+                remaining++;
+    }
+
+    unblock_signal(SIGCHLD);
+    free(tests);
+    free(jobs);
+    return launched;
+}
+
+int schedule_shutdown(struct dcategory **categories, long timeout_milli) {
+    int i, njobs = 0, npending, killed = 0, killed_running;
+    struct dapplication *a;
+    struct plist *pl;
+    struct job *jobs = NULL;
+    struct timespec deadline;
+
+    /* collect the processes of all categories or every supervised process */
+    if (categories) {
+        for (; *categories; categories++) {
+            for (a = (*categories)->active_application; a; a = a->next_optional) {
+                if ((pl = plist_get_content(a))) {
+                    add_job(&jobs, &njobs, a, *categories);
+                    jobs[njobs - 1].process = pl;
+                }
+            }
+        }
+    } else {
+        for (pl = plist_peek(); pl; pl = pl->next) {
+            a = (struct dapplication *) pl->content;
+            add_job(&jobs, &njobs, a, find_owning_category(a));
+            jobs[njobs - 1].process = pl;
+        }
+    }
+    if (njobs == 0)
+        return 0;
+
+    struct plist *pending[njobs];
+
+    /* all processes share one deadline, independent of how many there are */
+    if (!plist_deadline(&deadline, timeout_milli))
+        deadline.tv_sec = 0;
+
+    for (;;) {
+        for (i = 0; i < njobs; i++)
+            if (jobs[i].state != JobDone && jobs[i].process->status_changed)
+                jobs[i].state = JobDone;
+
+        /* stop categories in reverse dependency order, everything else at once */
+        for (i = 0; i < njobs; i++)
+            if (jobs[i].state == JobWaiting && dependents_done(jobs, njobs, &jobs[i]))
+                stop_job(&jobs[i]);
+
+        for (i = 0, npending = 0; i < njobs; i++)
+            if (jobs[i].state == JobStopping)
+                pending[npending++] = jobs[i].process;
+
+        if (npending == 0) {
+            /* break dependency cycles by stopping the first waiting job anyway */
+            for (i = 0; i < njobs && jobs[i].state != JobWaiting; i++);
+            if (i == njobs)
+                break;
+            DBGPRINT("Dependency cycle detected, stopping '%s' anyway\n", jobs[i].application->id_name);
+            stop_job(&jobs[i]);
+            continue;
+        }
+
+        if (!plist_wait_any(pending, npending, &deadline, -1))
+            break;
+    }
+
+    /* kill whatever is left once the deadline has passed */
+    for (i = 0, npending = 0; i < njobs; i++) {
+        if (jobs[i].state == JobDone || jobs[i].process->status_changed)
+            continue;
+        DBGPRINT("Killing '%s' (pid: %d)\n", jobs[i].application->id_name, jobs[i].process->pid);
+        if (kill(jobs[i].process->pid, SIGKILL) == 0)
+            pending[npending++] = jobs[i].process;
+        killed++;
+    }
+
+    /* give the kernel a moment, so killed processes can be reaped */
+    if (npending > 0 && plist_deadline(&deadline, SCHEDULER_KILL_TIMEOUT)) {
+        do {
+            for (i = 0, killed_running = 0; i < npending; i++)
+                if (!pending[i]->status_changed)
+                    pending[killed_running++] = pending[i];
+            npending = killed_running;
+        } while (npending > 0 && plist_wait_any(pending, npending, &deadline, -1));
+    }
+
+    for (i = 0; i < njobs; i++)
+        plist_remove(jobs[i].process->pid);
+    free(jobs);
+    return killed;
+}
+
+int start_job(struct job *j, struct dtest *t, int *running) {
+    if (test_start(t, j->application)) {
+        /* no test process required */
+        t->state = TestIdle;
+        return finish_job(j, t->available);
+    }
+
+    j->state = JobTesting;
+    (*running)++;
+    return 0;
+}
+
+void stop_job(struct job *j) {
+    /* the process might already be gone */
+    if (kill(j->process->pid, SIGTERM) == -1)
+        j->state = JobDone;
+    else
+        j->state = JobStopping;
+}
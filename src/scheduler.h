@@ -0,0 +1,34 @@
+#ifndef H_SCHEDULER
+#define H_SCHEDULER
+
+#include "desktop-application.h"
+
+#define SCHEDULER_MAX_DEPENDENCIES  16
+#define SCHEDULER_KILL_TIMEOUT      500 /* milliseconds */
+#define SCHEDULER_READY_TIMEOUT     10000 /* milliseconds */
+
+/*
+ * start the applications of all given categories (NULL terminated)
+ *
+ * independent categories are tested and launched in parallel, but never more than max_jobs
+ * availability tests run at the same time
+ * a category is only started after all categories listed in the X-Pademelon-After key of its
+ * application have been started, applications with X-Pademelon-Notify=true only count as started
+ * once they have sent READY=1 (see readiness.h), terminated or SCHEDULER_READY_TIMEOUT has passed
+ *
+ * returns the number of launched applications
+ */
+int schedule_startup(struct dcategory **categories, int max_jobs);
+/*
+ * stop the processes of all given categories (NULL terminated) or all supervised processes (NULL)
+ *
+ * categories are sent SIGTERM in reverse X-Pademelon-After order, independent ones at the same time
+ * all processes share one deadline of timeout_milli milliseconds, after which the remaining ones
+ * are killed
+ * the processes are removed from the plist
+ *
+ * returns the number of processes that had to be killed
+ */
+int schedule_shutdown(struct dcategory **categories, long timeout_milli);
+
+#endif /* H_SCHEDULER */
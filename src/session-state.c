@@ -0,0 +1,320 @@
+#include "common.h"
+#include "desktop-application.h"
+#include "pademelon-config.h"
+#include "session-state.h"
+#include "signals.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static inline size_t ALIGN8(size_t n) { return (n + 7) & ~((size_t) 7); }
+
+struct sstate_builder {
+    char *strings;
+    size_t strings_len, strings_cap;
+    struct sstate_category *categories;
+    size_t ncategories;
+    struct sstate_process *processes;
+    size_t nprocesses, processes_cap;
+};
+
+static uint32_t add_string(struct sstate_builder *b, const char *s);
+static void add_processes(struct sstate_builder *b, struct dcategory *c, time_t realtime_offset);
+static int current_config(void);
+static void unmap(void);
+static int valid(void);
+static int write_state(struct sstate_builder *b, const char *path);
+
+static uint32_t generation = 0;
+static const struct sstate_header *header = NULL;
+static size_t header_size = 0;
+
+
+uint32_t add_string(struct sstate_builder *b, const char *s) {
+    size_t len, offset;
+    char *temp;
+
+    if (!s)
+        return SSTATE_NULL;
+
+    len = strlen(s) + 1;
+    if (b->strings_len + len > b->strings_cap) {
+        b->strings_cap = (b->strings_cap + len) * 2;
+        temp = realloc(b->strings, b->strings_cap);
+        if (!temp)
+            die("Unable to allocate memory for session state");
+        b->strings = temp;
+    }
+
+    offset = b->strings_len;
+    memcpy(&b->strings[offset], s, len);
+    b->strings_len += len;
+    return (uint32_t) offset;
+}
+
+void add_processes(struct sstate_builder *b, struct dcategory *c, time_t realtime_offset) {
+    struct dapplication *a;
+    struct plist *pl;
+    struct sstate_process *p;
+
+    for (pl = plist_peek(); pl; pl = pl->next) {
+        a = (struct dapplication *) pl->content;
+        if (!a || find_owning_category(a) != c)
+            continue;
+
+        if (b->nprocesses >= b->processes_cap) {
+            b->processes_cap = b->processes_cap ? b->processes_cap * 2 : 16;
+            p = realloc(b->processes, sizeof(struct sstate_process) * b->processes_cap);
+            if (!p)
+                die("Unable to allocate memory for session state");
+            b->processes = p;
+        }
+
+        p = &b->processes[b->nprocesses++];
+        memset(p, 0, sizeof(*p));
+        p->pid = (int32_t) pl->pid;
+        p->restarts = (uint32_t) pl->restarts;
+        p->last_status = (int32_t) pl->last_status;
+        p->ready = !a->notify || pl->ready;
+        p->id = add_string(b, a->id_name);
+        p->launch_cmd = add_string(b, a->launch_cmd);
+        p->started = (int64_t) (pl->started.tv_sec + realtime_offset);
+    }
+}
+
+int current_config(void) {
+    int i;
+    struct timespec mtimes[2];
+
+    /* the selections were resolved with the config the daemon has loaded */
+    config_mtimes(mtimes);
+    for (i = 0; i < 2; i++)
+        if (header->config_mtimes[2 * i] != (int64_t) mtimes[i].tv_sec
+                || header->config_mtimes[2 * i + 1] != (int64_t) mtimes[i].tv_nsec)
+            return 0;
+    return 1;
+}
+
+const struct sstate_category *sstate_category(const char *name) {
+    uint32_t i;
+    const char *s;
+    const struct sstate_category *categories;
+
+    if (!header || !name)
+        return NULL;
+
+    categories = (const struct sstate_category *) ((const char *) header + header->categories);
+    for (i = 0; i < header->ncategories; i++)
+        if ((s = sstate_string(categories[i].name)) && strcmp(s, name) == 0)
+            return &categories[i];
+    return NULL;
+}
+
+void sstate_close(void) {
+    unmap();
+}
+
+const struct sstate_header *sstate_open(void) {
+    int fd;
+    void *m;
+    char *path;
+    struct stat filestats;
+
+    if (header)
+        return header;
+
+    path = user_runtime_path(SSTATE_FILE_NAME);
+    if (!path)
+        return NULL;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &filestats) == -1 || filestats.st_size < (off_t) sizeof(struct sstate_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    m = mmap(NULL, (size_t) filestats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+        return NULL;
+
+    header = (const struct sstate_header *) m;
+    header_size = (size_t) filestats.st_size;
+
+    /* a daemon that was killed could not remove its state */
+    if (!valid() || (kill((pid_t) header->daemon_pid, 0) == -1 && errno != EPERM) || !current_config()) {
+        unmap();
+        return NULL;
+    }
+    return header;
+}
+
+const struct sstate_process *sstate_process(const struct sstate_category *c, uint32_t i) {
+    if (!header || !c || i >= c->nprocesses)
+        return NULL;
+    return (const struct sstate_process *) ((const char *) header + header->processes) + c->process + i;
+}
+
+int sstate_publish(void) {
+    int status;
+    char *path;
+    size_t i;
+    struct dapplication *selected;
+    struct dcategory *c;
+    struct sstate_builder b = {0};
+    struct timespec now, realtime;
+
+    path = user_runtime_path(SSTATE_FILE_NAME);
+    if (!path)
+        return 0;
+
+    /* start times are kept on the monotonic clock, readers expect wall clock time */
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1 || clock_gettime(CLOCK_REALTIME, &realtime) == -1) {
+        free(path);
+        return 0;
+    }
+
+    c = get_categories();
+    for (b.ncategories = 0; c[b.ncategories].name; b.ncategories++);
+    b.categories = calloc(b.ncategories ? b.ncategories : 1, sizeof(struct sstate_category));
+    if (!b.categories)
+        die("Unable to allocate memory for session state");
+
+    for (i = 0; i < b.ncategories; i++) {
+        b.categories[i].name = add_string(&b, c[i].name);
+        b.categories[i].user_preference = add_string(&b, c[i].user_preference);
+
+        /* resolved from the in-memory index, so this does not touch the disk */
+        selected = select_application(&c[i]);
+        b.categories[i].selected = add_string(&b, selected ? selected->id_name : NULL);
+        b.categories[i].launch_cmd = add_string(&b, selected ? selected->launch_cmd : NULL);
+        free_application(selected);
+
+        b.categories[i].process = (uint32_t) b.nprocesses;
+        add_processes(&b, &c[i], realtime.tv_sec - now.tv_sec);
+        b.categories[i].nprocesses = (uint32_t) b.nprocesses - b.categories[i].process;
+    }
+
+    status = write_state(&b, path);
+    free(path);
+    free(b.strings);
+    free(b.categories);
+    free(b.processes);
+    return status;
+}
+
+void sstate_remove(void) {
+    char *path;
+
+    path = user_runtime_path(SSTATE_FILE_NAME);
+    if (path)
+        unlink(path);
+    free(path);
+}
+
+const char *sstate_string(uint32_t offset) {
+    if (!header || offset == SSTATE_NULL || offset >= header->strings_size)
+        return NULL;
+    return (const char *) header + header->strings + offset;
+}
+
+void unmap(void) {
+    if (header)
+        munmap((void *) header, header_size);
+    header = NULL;
+    header_size = 0;
+}
+
+int valid(void) {
+    uint32_t i;
+    const struct sstate_category *categories;
+
+    /* check file layout */
+    if (memcmp(header->magic, SSTATE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != SSTATE_VERSION
+            || header->size != header_size
+            || header->daemon_pid <= 0
+            || (size_t) header->categories + sizeof(struct sstate_category) * header->ncategories > header_size
+            || (size_t) header->processes + sizeof(struct sstate_process) * header->nprocesses > header_size
+            || (size_t) header->strings + header->strings_size > header_size
+            || (header->strings_size > 0 && ((const char *) header)[header->strings + header->strings_size - 1] != '\0'))
+        return 0;
+
+    /* process ranges must only point to existing processes */
+    categories = (const struct sstate_category *) ((const char *) header + header->categories);
+    for (i = 0; i < header->ncategories; i++)
+        if ((size_t) categories[i].process + categories[i].nprocesses > header->nprocesses)
+            return 0;
+    return 1;
+}
+
+int write_state(struct sstate_builder *b, const char *path) {
+    int fd, status;
+    char *temppath;
+    int i;
+    size_t offset;
+    struct sstate_header h = {0};
+    struct timespec mtimes[2];
+
+    /* lay out file */
+    memcpy(h.magic, SSTATE_MAGIC, sizeof(h.magic));
+    h.version = SSTATE_VERSION;
+    h.daemon_pid = (int32_t) getpid();
+    h.generation = ++generation;
+    config_loaded_mtimes(mtimes);
+    for (i = 0; i < 2; i++) {
+        h.config_mtimes[2 * i] = (int64_t) mtimes[i].tv_sec;
+        h.config_mtimes[2 * i + 1] = (int64_t) mtimes[i].tv_nsec;
+    }
+    h.ncategories = (uint32_t) b->ncategories;
+    h.nprocesses = (uint32_t) b->nprocesses;
+    offset = ALIGN8(sizeof(struct sstate_header));
+    h.categories = (uint32_t) offset;
+    offset = ALIGN8(offset + sizeof(struct sstate_category) * b->ncategories);
+    h.processes = (uint32_t) offset;
+    offset = ALIGN8(offset + sizeof(struct sstate_process) * b->nprocesses);
+    h.strings = (uint32_t) offset;
+    h.strings_size = (uint32_t) b->strings_len;
+    offset += b->strings_len;
+    if (offset > UINT32_MAX)
+        return 0;
+    h.size = (uint32_t) offset;
+
+    /* write to temporary file and move it into place atomically, readers keep the old mapping */
+    temppath = malloc(strlen(path) + strlen(".XXXXXX") + 1);
+    if (!temppath)
+        die("Unable to allocate memory for session state");
+    sprintf(temppath, "%s.XXXXXX", path);
+    fd = mkstemp(temppath);
+    if (fd == -1) {
+        free(temppath);
+        return 0;
+    }
+
+    status = pwrite(fd, &h, sizeof(h), 0) == sizeof(h)
+        && pwrite(fd, b->categories, sizeof(struct sstate_category) * b->ncategories, h.categories)
+                == (ssize_t) (sizeof(struct sstate_category) * b->ncategories)
+        && pwrite(fd, b->processes, sizeof(struct sstate_process) * b->nprocesses, h.processes)
+                == (ssize_t) (sizeof(struct sstate_process) * b->nprocesses)
+        && pwrite(fd, b->strings, b->strings_len, h.strings) == (ssize_t) b->strings_len;
+    if (close(fd) == -1)
+        status = 0;
+    if (status && rename(temppath, path) == -1)
+        status = 0;
+    if (!status) {
+        DBGPRINT("Unable to write session state '%s': %s\n", path, strerror(errno));
+        unlink(temppath);
+    }
+
+    free(temppath);
+    return status;
+}
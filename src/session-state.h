@@ -0,0 +1,70 @@
+#ifndef H_SESSION_STATE
+#define H_SESSION_STATE
+
+#include <stdint.h>
+
+#define SSTATE_FILE_NAME    "session"
+#define SSTATE_MAGIC        "PDMLSESS"
+#define SSTATE_VERSION      2
+#define SSTATE_NULL         UINT32_MAX
+
+/*
+ * resolved session state, published by the daemon at $XDG_RUNTIME_DIR/pademelon/session
+ *
+ * file layout (native byte order, all offsets relative to the start of the file):
+ *
+ *   header | categories[ncategories] | processes[nprocesses] | strings
+ *
+ * categories are stored in the order of get_categories(), the processes of a category follow each
+ * other (newest first), string fields are offsets into the string table or SSTATE_NULL
+ * the file is replaced atomically, so a mapping always shows a consistent state
+ * readers ignore the state once a config file differs from the one the daemon has loaded
+ */
+struct sstate_header {
+    char magic[8];
+    uint32_t version, size;
+    int32_t daemon_pid;
+    uint32_t generation; /* incremented with every update of the daemon */
+    uint32_t ncategories, nprocesses;
+    uint32_t categories, processes, strings, strings_size;
+    int64_t config_mtimes[4]; /* seconds and nanoseconds of the loaded system and user config */
+};
+
+struct sstate_category {
+    uint32_t name, user_preference;
+    uint32_t selected, launch_cmd; /* application selected by the current config and desktop entries */
+    uint32_t process, nprocesses; /* range in processes */
+};
+
+struct sstate_process {
+    int32_t pid;
+    int32_t last_status; /* as obtained from waitpid, only valid if restarts > 0 */
+    uint32_t restarts; /* automatic restarts before this process */
+    uint32_t ready; /* started and ready to be used (see X-Pademelon-Notify) */
+    uint32_t id, launch_cmd;
+    int64_t started; /* seconds since the epoch */
+};
+
+/*
+ * daemon side: write the state of all categories and supervised processes
+ *
+ * returns 1 on success, 0 otherwise (e.g. without $XDG_RUNTIME_DIR)
+ */
+int sstate_publish(void);
+/* remove the published state, e.g. before the daemon exits */
+void sstate_remove(void);
+
+/*
+ * reader side: map the state published by a running daemon
+ *
+ * returns NULL if there is no valid state, the daemon that has written it is gone or the config has
+ * changed since the daemon has loaded it
+ * the mapping stays valid until sstate_close(), even if the daemon updates the file in between
+ */
+const struct sstate_header *sstate_open(void);
+void sstate_close(void);
+const struct sstate_category *sstate_category(const char *name);
+const struct sstate_process *sstate_process(const struct sstate_category *c, uint32_t i);
+const char *sstate_string(uint32_t offset);
+
+#endif /* H_SESSION_STATE */
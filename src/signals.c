@@ -1,23 +1,41 @@
+#define _DEFAULT_SOURCE /* syscall() */
 #include "common.h"
 #include "signals.h"
 #include "desktop-application.h"
 #include <errno.h>
+#include <poll.h>
 #include <signal.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <time.h>
+#include <unistd.h>
 
-static void plist_sigchld_handler(int signal);
+static int pidfd_open(pid_t pid);
+static unsigned int plist_hash(const char *s);
+static void plist_set_changed(struct plist *pl, int status);
+static void plist_unlink(struct plist *pl);
+static int time_remaining(const struct timespec *deadline, struct timespec *remaining);
 
+static int block_depth[SIGNAL_MAX];
 static struct plist *plist_head = NULL;
+static struct plist *by_pid[PLIST_BUCKETS], *by_id[PLIST_BUCKETS], *by_category[PLIST_BUCKETS];
+static struct plist *ready_head = NULL, *ready_tail = NULL; /* entries with a changed status */
+static int use_pidfds = 0;
+static plist_watcher watch_process = NULL, unwatch_process = NULL;
 static struct sigaction sigaction_sigchld_prev_handler = { .sa_handler = SIG_DFL, .sa_flags = SA_NODEFER|SA_NOCLDSTOP|SA_RESTART};
 
 int block_signal(int signal) {
     int status;
     sigset_t sigset;
 
+	/* only the outermost call actually touches the signal mask */
+	if (signal > 0 && signal < SIGNAL_MAX && block_depth[signal]++ > 0)
+		return 1;
+
 	/* create sigset for blocking signal */
 	status = sigemptyset(&sigset);
 	if (status == -1)
@@ -46,76 +64,119 @@ int install_default_sigchld_handler(void) {
     return 1;
 }
 
-int install_plist_sigchld_handler(void) {
-    int status;
-	struct sigaction sigaction_sigchld_handler = { .sa_handler = &plist_sigchld_handler, .sa_flags = SA_NODEFER|SA_NOCLDSTOP|SA_RESTART};
-
-	/* handle SIGCHLD*/
-	status = sigfillset(&sigaction_sigchld_handler.sa_mask); // @TODO do I have to block anything here?
-	if (status == -1)
-		return 0;
-
-	status = sigaction(SIGCHLD, &sigaction_sigchld_handler, &sigaction_sigchld_prev_handler);
-	if (status == -1)
-		return 0;
-    return 1;
+int pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else /* SYS_pidfd_open */
+    (void) pid;
+    errno = ENOSYS;
+    return -1;
+#endif /* SYS_pidfd_open */
 }
 
 struct plist *plist_add(pid_t pid, void *content) {
     struct plist *new_element;
+    struct dapplication *app = (struct dapplication *) content;
+    unsigned int h;
 
     /* create new element */
     new_element = calloc(1, sizeof(struct plist));
     if (!new_element)
         die("Unable to allocate memory for plist");
     new_element->pid = pid;
+    new_element->pidfd = use_pidfds ? pidfd_open(pid) : -1;
+    clock_gettime(CLOCK_MONOTONIC, &new_element->started);
     new_element->content = content;
 
-    block_signal(SIGCHLD);
-
     /* add new element to list */
     new_element->next = plist_head;
+    if (plist_head)
+        plist_head->prev = new_element;
     plist_head = new_element;
 
-    unblock_signal(SIGCHLD);
+    /* add new element to the indices */
+    h = PLIST_PID_HASH(pid);
+    new_element->next_pid = by_pid[h];
+    by_pid[h] = new_element;
+    if (app && app->id_name) {
+        h = plist_hash(app->id_name);
+        new_element->next_id = by_id[h];
+        by_id[h] = new_element;
+    }
+    if (app && app->category && app->category->name) {
+        h = plist_hash(app->category->name);
+        new_element->next_category = by_category[h];
+        by_category[h] = new_element;
+    }
+
+    if (new_element->pidfd >= 0 && watch_process)
+        watch_process(new_element);
     return new_element;
 }
 
+int plist_deadline(struct timespec *deadline, long timeout_milli) {
+    if (clock_gettime(CLOCK_MONOTONIC, deadline) == -1)
+        return 0;
+    deadline->tv_sec += timeout_milli / 1000;
+    deadline->tv_nsec += (timeout_milli % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+    return 1;
+}
+
 struct plist *plist_get(pid_t pid) {
     struct plist *pl;
 
-    block_signal(SIGCHLD);
-
-    /* go through list and check if pid matches */
-    for (pl = plist_head; pl; pl = pl->next) {
+    for (pl = by_pid[PLIST_PID_HASH(pid)]; pl; pl = pl->next_pid) {
         if (pl->pid == pid) {
-            unblock_signal(SIGCHLD);
             return pl;
         }
     }
-
-    unblock_signal(SIGCHLD);
     return NULL;
 }
 
-struct plist *plist_next_event(struct plist *from) {
+struct plist *plist_get_content(const void *content) {
     struct plist *pl;
+    const struct dapplication *app = (const struct dapplication *) content;
 
-    block_signal(SIGCHLD);
+    if (!app || !app->id_name)
+        return NULL;
 
-    /* go through list and check status has changed */
-    for (pl = from ? from : plist_head; pl; pl = pl->next) {
-        if (pl->status_changed) {
-            pl->status_changed = 0;
-            unblock_signal(SIGCHLD);
+    /* the content is an application, so it is indexed by its id */
+    for (pl = by_id[plist_hash(app->id_name)]; pl; pl = pl->next_id) {
+        if (pl->content == content) {
             return pl;
         }
     }
-
-    unblock_signal(SIGCHLD);
     return NULL;
 }
 
+unsigned int plist_hash(const char *s) {
+    unsigned int h = 5381;
+
+    for (; *s; s++)
+        h = h * 33 + (unsigned char) *s;
+    return h & (PLIST_BUCKETS - 1);
+}
+
+struct plist *plist_next_event(void) {
+    struct plist *pl;
+
+    /* take the oldest entry from the ready queue */
+    pl = ready_head;
+    if (!pl)
+        return NULL;
+    ready_head = pl->next_event;
+    if (!ready_head)
+        ready_tail = NULL;
+    pl->next_event = NULL;
+    pl->queued = 0;
+    pl->status_changed = 0;
+    return pl;
+}
+
 void plist_free(void) {
     while (plist_head)
         plist_remove(plist_head->pid);
@@ -129,86 +190,219 @@ struct plist *plist_pop(void) {
     struct plist *pl_remove = NULL;
     pl_remove = plist_head;
     if (plist_head)
-        plist_head = plist_head->next;
+        plist_unlink(pl_remove);
     return pl_remove;
 }
 
 void plist_remove(pid_t pid) {
-    struct plist *pl, *pl_remove = NULL;
-
-    block_signal(SIGCHLD);
-
-    /* check if head matches */
-    if (plist_head->pid == pid) {
-        pl_remove = plist_head;
-        plist_head = pl_remove->next;
-    } else {
-        /* search for the entry before pid */
-        for (pl = plist_head; pl && pl->next; pl = pl->next) {
-            if (pl->next->pid == pid) {
-                pl_remove = pl->next;
-                pl->next = pl_remove->next;
-                break;
-            }
-        }
-    }
+    struct plist *pl_remove;
 
-    unblock_signal(SIGCHLD);
+    pl_remove = plist_get(pid);
+    if (!pl_remove)
+        return;
+    plist_unlink(pl_remove);
 
-    /* free item (NULL anyway if not found) */
+    if (pl_remove->pidfd >= 0) {
+        if (unwatch_process)
+            unwatch_process(pl_remove);
+        close(pl_remove->pidfd);
+    }
     free(pl_remove);
 }
 
 struct plist *plist_search(char *id_name, char *category) {
     struct plist *pl;
 
-    block_signal(SIGCHLD);
-
-    /* go through list and check for matching values */
-    for (pl = plist_head; pl; pl = pl->next) {
-        /* @TODO check for access on NULL pointers */
-        if ((id_name && strcmp(id_name, ((struct dapplication*) pl->content)->id_name) == 0)
-                || (category && strcmp(category, ((struct dapplication*) pl->content)->category->name) == 0)) {
-            unblock_signal(SIGCHLD);
-            return pl;
+    if (id_name) {
+        for (pl = by_id[plist_hash(id_name)]; pl; pl = pl->next_id) {
+            if (strcmp(id_name, ((struct dapplication*) pl->content)->id_name) == 0) {
+                return pl;
+            }
+        }
+    }
+    if (category) {
+        for (pl = by_category[plist_hash(category)]; pl; pl = pl->next_category) {
+            if (strcmp(category, ((struct dapplication*) pl->content)->category->name) == 0) {
+                return pl;
+            }
         }
     }
-
-    unblock_signal(SIGCHLD);
     return NULL;
 }
 
-void plist_sigchld_handler(int signal) {
-	pid_t pid;
-	int status;
-	int errno_save = errno;
+void plist_set_changed(struct plist *pl, int status) {
+    pl->status = status;
+    pl->status_changed = 1;
+
+    /* every entry is queued at most once */
+    if (pl->queued)
+        return;
+    pl->queued = 1;
+    if (ready_tail)
+        ready_tail->next_event = pl;
+    else
+        ready_head = pl;
+    ready_tail = pl;
+}
+
+struct plist *plist_set_status(pid_t pid, int status) {
     struct plist *pl;
 
-	if (signal != SIGCHLD) {
-		/* should not happen */
-		return;
-	}
+    pl = plist_get(pid);
+    if (pl)
+        plist_set_changed(pl, status);
+    return pl;
+}
 
-	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        pl = plist_get(pid);
-        if (pl) {
-            pl->status = status;
-            pl->status_changed = 1;
-        }
-	}
+void plist_unlink(struct plist *pl) {
+    struct plist **link, *prev_event;
+    struct dapplication *app = (struct dapplication *) pl->content;
+
+    if (pl->prev)
+        pl->prev->next = pl->next;
+    else
+        plist_head = pl->next;
+    if (pl->next)
+        pl->next->prev = pl->prev;
+    pl->next = pl->prev = NULL;
+
+    for (link = &by_pid[PLIST_PID_HASH(pl->pid)]; *link && *link != pl; link = &(*link)->next_pid);
+    if (*link)
+        *link = pl->next_pid;
+    if (app && app->id_name) {
+        for (link = &by_id[plist_hash(app->id_name)]; *link && *link != pl; link = &(*link)->next_id);
+        if (*link)
+            *link = pl->next_id;
+    }
+    if (app && app->category && app->category->name) {
+        for (link = &by_category[plist_hash(app->category->name)]; *link && *link != pl;
+                link = &(*link)->next_category);
+        if (*link)
+            *link = pl->next_category;
+    }
 
-	errno = errno_save;
+    if (pl->queued) {
+        for (prev_event = NULL, link = &ready_head; *link != pl; link = &(*link)->next_event)
+            prev_event = *link;
+        *link = pl->next_event;
+        if (ready_tail == pl)
+            ready_tail = prev_event;
+        pl->queued = 0;
+    }
+    pl->next_pid = pl->next_id = pl->next_category = pl->next_event = NULL;
 }
 
-void plist_wait(struct plist *pl, long timeout_milli) {
+void plist_reap(void) {
+    pid_t pid;
     int status;
-    struct timespec ts = { .tv_sec = 0, .tv_nsec = timeout_milli * 1000 };
-    while (!pl->status_changed) {
-        status = nanosleep(&ts, &ts);
-        if (status == 0 /* time elapsed */
-                || (status == -1 && errno != EINTR)) /* real error */
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        plist_set_status(pid, status);
+}
+
+int plist_reap_process(struct plist *pl) {
+    int status;
+    pid_t pid;
+
+    /* the pid cannot be reused by another process before we have reaped it */
+    pid = waitpid(pl->pid, &status, WNOHANG);
+    if (pid == pl->pid) {
+        plist_set_changed(pl, status);
+        return 1;
+    }
+    /* already reaped by somebody else */
+    return pid == -1 && errno == ECHILD;
+}
+
+int plist_use_pidfds(plist_watcher watch, plist_watcher unwatch) {
+    int fd;
+
+    /* check if the kernel supports pidfds at all */
+    fd = pidfd_open(getpid());
+    if (fd < 0)
+        return 0;
+    close(fd);
+
+    use_pidfds = 1;
+    watch_process = watch;
+    unwatch_process = unwatch;
+    return 1;
+}
+
+int plist_wait_any(struct plist **pls, int n, const struct timespec *deadline, int wake_fd) {
+    int i, nfds, status, use_pidfds_only = 1, changed = 0;
+    long timeout_milli;
+    struct timespec remaining;
+    struct pollfd fds[n + 1];
+
+    for (i = 0; i < n; i++)
+        if (pls[i]->pidfd < 0)
+            use_pidfds_only = 0;
+
+    /* without pidfds SIGCHLD is kept pending, so we can sleep until any child changes its state */
+    if (!use_pidfds_only)
+        block_signal(SIGCHLD);
+
+    for (;;) {
+        if (!use_pidfds_only)
+            plist_reap();
+        for (i = 0; i < n && !pls[i]->status_changed; i++);
+        if (i < n) {
+            changed = 1;
+            break;
+        }
+        if (!time_remaining(deadline, &remaining))
             break;
+
+        if (use_pidfds_only) {
+            /* the pidfds become readable as soon as the processes have terminated */
+            for (i = 0; i < n; i++) {
+                fds[i].fd = pls[i]->pidfd;
+                fds[i].events = POLLIN;
+                fds[i].revents = 0;
+            }
+            nfds = n;
+            if (wake_fd >= 0) {
+                fds[nfds].fd = wake_fd;
+                fds[nfds].events = POLLIN;
+                fds[nfds++].revents = 0;
+            }
+            timeout_milli = remaining.tv_sec * 1000 + (remaining.tv_nsec + 999999) / 1000000;
+            status = poll(fds, (nfds_t) nfds, (int) timeout_milli);
+            if (status == -1 && errno != EINTR)
+                break;
+            for (i = 0; status > 0 && i < n; i++)
+                if (fds[i].revents)
+                    plist_reap_process(pls[i]);
+            if (status > 0 && nfds > n && fds[n].revents) {
+                changed = 1;
+                break;
+            }
+        } else {
+            status = wait_sigchld(&remaining, wake_fd);
+            if (status == -1)
+                break;
+            if (status == 1) {
+                changed = 1;
+                break;
+            }
+        }
     }
+
+    if (!use_pidfds_only)
+        unblock_signal(SIGCHLD);
+    return changed;
+}
+
+int reset_signal_mask(void) {
+    sigset_t sigset;
+
+    /* meant for freshly forked children, which must not inherit our blocked signals */
+    if (sigemptyset(&sigset) == -1)
+        return 0;
+    if (sigprocmask(SIG_SETMASK, &sigset, NULL) == -1)
+        return 0;
+    return 1;
 }
 
 int restore_sigchld_handler(void) {
@@ -223,6 +417,10 @@ int unblock_signal(int signal) {
     int status;
     sigset_t sigset;
 
+	/* keep the signal blocked until the outermost caller unblocks it */
+	if (signal > 0 && signal < SIGNAL_MAX && block_depth[signal] > 0 && --block_depth[signal] > 0)
+		return 1;
+
 	/* create sigset for blocking signal */
 	status = sigemptyset(&sigset);
 	if (status == -1)
@@ -235,3 +433,53 @@ int unblock_signal(int signal) {
         return 0;
     return 1;
 }
+
+int time_remaining(const struct timespec *deadline, struct timespec *remaining) {
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        return 0;
+    remaining->tv_sec = deadline->tv_sec - now.tv_sec;
+    remaining->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (remaining->tv_nsec < 0) {
+        remaining->tv_sec--;
+        remaining->tv_nsec += 1000000000;
+    }
+    return remaining->tv_sec >= 0;
+}
+
+int wait_sigchld(const struct timespec *timeout, int fd) {
+    int sfd, status;
+    long timeout_milli;
+    sigset_t sigset;
+    struct signalfd_siginfo info;
+    struct pollfd fds[2];
+
+    if (sigemptyset(&sigset) == -1 || sigaddset(&sigset, SIGCHLD) == -1)
+        return -1;
+
+    if (fd < 0) {
+        if (sigtimedwait(&sigset, NULL, timeout) == -1 && errno != EAGAIN && errno != EINTR)
+            return -1;
+        return 0;
+    }
+
+    /* the pending signal is consumed through a temporary signalfd, so it can be polled with fd */
+    sfd = signalfd(-1, &sigset, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd == -1)
+        return -1;
+    fds[0].fd = sfd;
+    fds[1].fd = fd;
+    fds[0].events = fds[1].events = POLLIN;
+    fds[0].revents = fds[1].revents = 0;
+
+    timeout_milli = timeout->tv_sec * 1000 + (timeout->tv_nsec + 999999) / 1000000;
+    status = poll(fds, 2, (int) timeout_milli);
+    if (status > 0 && fds[0].revents && read(sfd, &info, sizeof(info)) != sizeof(info))
+        DBGPRINT("%s\n", "Unable to read SIGCHLD from signalfd");
+    close(sfd);
+
+    if (status == -1)
+        return errno == EINTR ? 0 : -1;
+    return status > 0 && fds[1].revents ? 1 : 0;
+}
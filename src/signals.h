@@ -2,28 +2,77 @@
 #define H_SIGNALS
 
 #include <sys/types.h>
+#include <time.h>
 
+#define SIGNAL_MAX      65
+#define PLIST_BUCKETS   256 /* power of two */
+#define PLIST_PID_HASH(pid)     ((unsigned int) (pid) & (PLIST_BUCKETS - 1))
+
+/*
+ * table of supervised processes
+ *
+ * entries are indexed by pid as well as by the id and category of their application (content)
+ * and are queued for plist_next_event() whenever their status changes
+ */
 struct plist {
     int status; /* as obtained from waitpid */
     int status_changed;
+    int queued;
     pid_t pid;
+    int pidfd; /* -1 if the process is not supervised with a pidfd */
+    int ready; /* READY=1 was received through the readiness socket */
+    struct timespec started; /* CLOCK_MONOTONIC */
+    int restarts; /* automatic restarts of the application before this process */
+    int last_status; /* status of the previous process, only valid if restarts > 0 */
     void *content;
-    struct plist *next;
+    struct plist *next, *prev; /* all entries, newest first */
+    struct plist *next_pid, *next_id, *next_category; /* bucket chains */
+    struct plist *next_event; /* ready queue */
 };
 
+typedef void (*plist_watcher)(struct plist *pl);
+
 int block_signal(int signal);
 int install_default_sigchld_handler(void);
-int install_plist_sigchld_handler(void);
 struct plist *plist_add(pid_t pid, void *content);
+/* set deadline to timeout_milli milliseconds from now (CLOCK_MONOTONIC), returns 1 on success */
+int plist_deadline(struct timespec *deadline, long timeout_milli);
 void plist_free(void);
 struct plist *plist_get(pid_t pid);
-struct plist *plist_next_event(struct plist *from);
+struct plist *plist_get_content(const void *content);
+struct plist *plist_next_event(void);
 struct plist *plist_peek(void);
 struct plist *plist_pop(void);
+/* collect the status of all terminated children (without blocking) */
+void plist_reap(void);
+/* collect the status of a single child once its pidfd is readable, returns 1 if it is gone */
+int plist_reap_process(struct plist *pl);
 void plist_remove(pid_t pid);
 struct plist *plist_search(char *id_name, char *category);
-void plist_wait(struct plist *pl, long timeout_milli);
+struct plist *plist_set_status(pid_t pid, int status);
+/*
+ * supervise processes added from now on with a pidfd each
+ *
+ * watch is called for every new process with a pidfd, unwatch before it is closed
+ * returns 0 if the kernel does not support pidfds, in which case SIGCHLD has to be handled instead
+ */
+int plist_use_pidfds(plist_watcher watch, plist_watcher unwatch);
+/*
+ * wait until at least one of the given processes has changed its status or deadline has passed
+ *
+ * the wait is also ended as soon as wake_fd becomes readable (ignored if negative)
+ * returns 1 if a status has changed or wake_fd is readable, 0 otherwise
+ */
+int plist_wait_any(struct plist **pls, int n, const struct timespec *deadline, int wake_fd);
+int reset_signal_mask(void);
 int restore_sigchld_handler(void);
 int unblock_signal(int signal);
+/*
+ * sleep until SIGCHLD (which has to be blocked) is pending, fd becomes readable or timeout has passed
+ *
+ * the pending SIGCHLD is consumed, fd is ignored if negative
+ * returns 1 if fd is readable, 0 otherwise and -1 on error
+ */
+int wait_sigchld(const struct timespec *timeout, int fd);
 
 #endif /* H_SIGNALS */
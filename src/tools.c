@@ -1,6 +1,12 @@
+#include "backlight.h"
 #include "common.h"
+#include "control.h"
 #include "desktop-application.h"
 #include "desktop-files.h"
+#ifdef PULSE
+#include "pulse-utils.h"
+#endif /* PULSE */
+#include "session-state.h"
 #include "tools.h"
 #ifdef X11
 #include "x11-utils.h"
@@ -26,10 +32,18 @@
 #ifdef CANBERRA
 static void canberra_play_async(const char *sound);
 #endif /* CANBERRA */
+#ifdef PULSE
+static int change_volume(int delta, int play_sound);
+static int delegate_volume(const char *command);
+static int set_volume(int percentage);
+#else /* PULSE */
 static int get_pa_volume(int *volume);
 static int set_pa_volume(int volume);
+#endif /* PULSE */
 static char* wallpaper_path(void);
 static int print_category(struct dcategory *c);
+static int print_session_state(void);
+static int select_from_session_state(const char *category);
 
 
 #ifdef CANBERRA
@@ -53,6 +67,40 @@ static void canberra_play_async(const char *sound) {
 }
 #endif /* CANBERRA */
 
+#ifdef PULSE
+int change_volume(int delta, int play_sound) {
+    int status;
+    char command[32];
+
+    snprintf(command, sizeof(command), "volume %+d%s", delta, play_sound ? "" : " quiet");
+    if ((status = delegate_volume(command)) >= 0)
+        return status;
+
+    /* read and changed on a single connection */
+    if (!pulse_change_volume(delta, NULL))
+        return EXIT_FAILURE;
+#ifdef CANBERRA
+    if (play_sound)
+        canberra_play_async(CANBERRA_VOLUME_CHANGE);
+#endif /* CANBERRA */
+    return EXIT_SUCCESS;
+}
+
+int delegate_volume(const char *command) {
+    int status;
+    char answer[CONTROL_LINE_SIZE];
+
+    /* the running daemon merges key repeats instead of letting them queue up behind each other */
+    status = control_request(command, answer, sizeof(answer));
+    if (status == 1)
+        return EXIT_SUCCESS;
+    if (status == 0) {
+        fprintf(stderr, "volume: %s", answer[0] ? answer : "no answer from daemon\n");
+        return EXIT_FAILURE;
+    }
+    return -1;
+}
+#else /* PULSE */
 int get_pa_volume(int *volume) {
     char cmd[] = "pactl get-sink-volume @DEFAULT_SINK@";
     char buffer[100];
@@ -81,27 +129,43 @@ int get_pa_volume(int *volume) {
     to[0] = '\0';
     return str_to_int(from, volume);
 }
+#endif /* PULSE */
 
 int tl_backlight_dec(int percentage) {
+    int status;
     char cmd_template[] = "xbacklight -dec %d";
     size_t tempsize = strlen(cmd_template) + 5;
     char temp[tempsize];
     percentage = MIN_INT(percentage, 100);
     percentage = MAX_INT(percentage, 0);
+    /* xbacklight is only needed if the backlight cannot be written through sysfs or logind */
+    if (backlight_init() && (status = backlight_change(-percentage, BACKLIGHT_FADE_DURATION)) != 0)
+        return status > 0 ? EXIT_SUCCESS : EXIT_FAILURE; /* a relative change must not be applied twice */
     snprintf(temp, tempsize, cmd_template, percentage);
     return system(temp);
 }
 
 int tl_backlight_print(void) {
-    return system("xbacklight -get");
+    int percentage;
+
+    if (!backlight_init())
+        return system("xbacklight -get");
+    if (!backlight_get(&percentage))
+        return EXIT_FAILURE;
+    if (printf("%d\n", percentage) < 0 || fflush(stdout) == EOF)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
 }
 
 int tl_backlight_inc(int percentage) {
+    int status;
     char cmd_template[] = "xbacklight -inc %d";
     size_t tempsize = strlen(cmd_template) + 5;
     char temp[tempsize];
     percentage = MIN_INT(percentage, 100);
     percentage = MAX_INT(percentage, 0);
+    if (backlight_init() && (status = backlight_change(percentage, BACKLIGHT_FADE_DURATION)) != 0)
+        return status > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     snprintf(temp, tempsize, cmd_template, percentage);
     return system(temp);
 }
@@ -112,11 +176,16 @@ int tl_backlight_set(int percentage) {
     char temp[tempsize];
     percentage = MIN_INT(percentage, 100);
     percentage = MAX_INT(percentage, 0);
+    /* the absolute value can still be set by xbacklight after a partial fade */
+    if (backlight_init() && backlight_set(percentage, BACKLIGHT_FADE_DURATION) > 0)
+        return EXIT_SUCCESS;
     snprintf(temp, tempsize, cmd_template, percentage);
     return system(temp);
 }
 
 int tl_launch_application(const char *category) {
+    int status;
+    char request[CONTROL_LINE_SIZE], answer[CONTROL_LINE_SIZE];
     struct dapplication *a;
     struct dcategory *c;
     struct config *cfg;
@@ -126,18 +195,31 @@ int tl_launch_application(const char *category) {
         return EXIT_FAILURE;
     }
 
-    cfg = load_config();
-    if (!cfg) {
-        fprintf(stderr, "select-application: unable to load config\n");
-        return EXIT_FAILURE;
-    }
-
     c = find_category(category);
     if (!c) {
         fprintf(stderr, "select-application: category not found\n");
         return EXIT_FAILURE;
     }
 
+    /* the running daemon already knows the selection and supervises the application */
+    if (strcmp(c->section, CONFIG_SECTION_APPLICATIONS) == 0) {
+        snprintf(request, sizeof(request), "launch %s", c->name);
+        status = control_request(request, answer, sizeof(answer));
+        if (status == 1)
+            return EXIT_SUCCESS;
+        if (status == 0) {
+            fprintf(stderr, "select-application: %s", answer[0] ? answer : "no answer from daemon\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* no daemon is running, so everything has to be loaded from scratch */
+    cfg = load_config();
+    if (!cfg) {
+        fprintf(stderr, "select-application: unable to load config\n");
+        return EXIT_FAILURE;
+    }
+
     a = select_application(c);
     if (!a) {
         fprintf(stderr, "select-application: no suitable application found\n");
@@ -196,6 +278,13 @@ int tl_print_applications(void) {
     struct dcategory *c;
     struct config *cfg;
 
+    /* the running daemon has already resolved everything */
+    if (sstate_open()) {
+        i = print_session_state();
+        sstate_close();
+        return i;
+    }
+
     cfg = load_config();
     if (!cfg) {
         fprintf(stderr, "select-application: unable to load config\n");
@@ -251,6 +340,10 @@ int tl_select_application(const char *category) {
         return EXIT_FAILURE;
     }
 
+    /* the running daemon has already resolved the selection */
+    if (select_from_session_state(category))
+        return EXIT_SUCCESS;
+
     cfg = load_config();
     if (!cfg) {
         fprintf(stderr, "select-application: unable to load config\n");
@@ -365,6 +458,7 @@ int tl_set_wallpaper(const char *input_path) {
 
 int print_category(struct dcategory *c) {
     int status;
+    struct dapplication *selected;
     status = printf("%s:\n", c->name);
     if (status < 0)
         return -1;
@@ -372,12 +466,70 @@ int print_category(struct dcategory *c) {
     if (status < 0)
         return -1;
     status = printf("\tactive application: %s\n", c->active_application ? c->active_application->id_name : "null");
-    status = printf("\tselected application: %s\n", select_application(c) ? select_application(c)->id_name : "null");
+    if (status < 0)
+        return -1;
+    selected = select_application(c);
+    status = printf("\tselected application: %s\n", selected ? selected->id_name : "null");
+    free_application(selected);
     if (status < 0)
         return -1;
     return 0;
 }
 
+int print_session_state(void) {
+    uint32_t i;
+    const char *s;
+    const struct sstate_header *h = sstate_open();
+    const struct sstate_category *c;
+
+    /* same format as print_category(), without loading any config or desktop entry */
+    for (i = 0; i < h->ncategories; i++) {
+        c = (const struct sstate_category *) ((const char *) h + h->categories) + i;
+        s = sstate_string(c->user_preference);
+        if (printf("%s:\n\tuser config: %s\n", sstate_string(c->name), s ? s : "(null)") < 0)
+            return EXIT_FAILURE;
+        s = c->nprocesses > 0 ? sstate_string(sstate_process(c, 0)->id) : NULL;
+        if (printf("\tactive application: %s\n", s ? s : "null") < 0)
+            return EXIT_FAILURE;
+        s = sstate_string(c->selected);
+        if (printf("\tselected application: %s\n\n", s ? s : "null") < 0)
+            return EXIT_FAILURE;
+    }
+    if (fflush(stdout) == EOF)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+int select_from_session_state(const char *category) {
+    int status;
+    const char *selected = NULL;
+    struct dcategory *c;
+    const struct sstate_category *sc;
+
+    /* categories are static, so looking them up does not load the config */
+    c = find_category(category);
+    if (!c || !sstate_open())
+        return 0;
+
+    if ((sc = sstate_category(c->name)))
+        selected = sstate_string(sc->selected);
+    status = selected && printf("%s\n", selected) >= 0 && fflush(stdout) != EOF;
+    sstate_close();
+    return status;
+}
+
+#ifdef PULSE
+int set_volume(int percentage) {
+    int status;
+    char command[32];
+
+    /* ordered with the relative changes queued by the daemon */
+    snprintf(command, sizeof(command), "volume %d", MAX_INT(percentage, 0));
+    if ((status = delegate_volume(command)) >= 0)
+        return status;
+    return pulse_set_volume(percentage) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#else /* PULSE */
 int set_pa_volume(int volume) {
     char cmd_template[] = "pactl set-sink-volume @DEFAULT_SINK@ %d%%";
     size_t tempsize = strlen(cmd_template) + 5;
@@ -387,6 +539,7 @@ int set_pa_volume(int volume) {
     snprintf(temp, tempsize, cmd_template, volume);
     return system(temp);
 }
+#endif /* PULSE */
 
 char* wallpaper_path(void) {
     return user_data_path(WALLPAPER_FILE_NAME);
@@ -415,12 +568,12 @@ int tl_test_application(const char *id_name) {
 
     if (test_application(a)) {
         /* we don't really care if the print works */
-        printf("Application available: (%s, \"%s\")\n", a->id_name, a->display_name);
+        printf("Application available: (%s, \"%s\")\n", a->id_name, application_display_name(a));
         fflush(stdout);
         return EXIT_SUCCESS;
     } else {
         /* we don't really care if the print works */
-        printf("Application not available: (%s, \"%s\")\n", a->id_name, a->display_name);
+        printf("Application not available: (%s, \"%s\")\n", a->id_name, application_display_name(a));
         fflush(stdout);
         return EXIT_FAILURE;
     }
@@ -429,6 +582,9 @@ int tl_test_application(const char *id_name) {
 }
 
 int tl_volume_dec(int percentage, int play_sound) {
+#ifdef PULSE
+    return change_volume(-percentage, play_sound);
+#else /* PULSE */
     int volume, status;
     if (!get_pa_volume(&volume))
         return EXIT_FAILURE;
@@ -440,9 +596,13 @@ int tl_volume_dec(int percentage, int play_sound) {
         status = set_pa_volume(volume - percentage);
         return status;
     }
+#endif /* PULSE */
 }
 
 int tl_volume_inc(int percentage, int play_sound) {
+#ifdef PULSE
+    return change_volume(percentage, play_sound);
+#else /* PULSE */
     int volume, status;
     if (!get_pa_volume(&volume))
         return EXIT_FAILURE;
@@ -455,9 +615,13 @@ int tl_volume_inc(int percentage, int play_sound) {
         status = set_pa_volume(volume + percentage);
         return status;
     }
+#endif /* PULSE */
 }
 
 int tl_volume_mute_input(int i) {
+#ifdef PULSE
+    return pulse_set_mute(PulseSource, i < 0 ? -1 : !!i) ? EXIT_SUCCESS : EXIT_FAILURE;
+#else /* PULSE */
     if (i < 0) {
         return system("pactl set-source-mute @DEFAULT_SOURCE@ toggle");
     } else if (i) {
@@ -465,9 +629,13 @@ int tl_volume_mute_input(int i) {
     } else {
         return system("pactl set-source-mute @DEFAULT_SOURCE@ 0");
     }
+#endif /* PULSE */
 }
 
 int tl_volume_mute_output(int i) {
+#ifdef PULSE
+    return pulse_set_mute(PulseSink, i < 0 ? -1 : !!i) ? EXIT_SUCCESS : EXIT_FAILURE;
+#else /* PULSE */
     if (i < 0) {
         return system("pactl set-sink-mute @DEFAULT_SINK@ toggle");
     } else if (i) {
@@ -475,11 +643,16 @@ int tl_volume_mute_output(int i) {
     } else {
         return system("pactl set-sink-mute @DEFAULT_SINK@ 0");
     }
+#endif /* PULSE */
 }
 
 int tl_volume_print(void) {
     int volume;
+#ifdef PULSE
+    if (!pulse_get_volume(&volume))
+#else /* PULSE */
     if (!get_pa_volume(&volume))
+#endif /* PULSE */
         return EXIT_FAILURE;
     else {
         if (printf("%d\n", volume) < 0)
@@ -492,6 +665,10 @@ int tl_volume_print(void) {
 
 int tl_volume_set(int percentage) {
     fprintf(stderr, "%d\n", percentage);
+#ifdef PULSE
+    return set_volume(percentage);
+#else /* PULSE */
     return set_pa_volume(percentage);
+#endif /* PULSE */
 }
 
@@ -4,6 +4,9 @@
 #ifdef IMLIB2
 #include <Imlib2.h>
 #endif /* IMLIB2 */
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <X11/Xatom.h>
@@ -12,10 +15,21 @@
 #include <X11/extensions/XInput2.h>
 
 
+static int ignore_errors(Display *dpy, XErrorEvent *error);
+static Bool unhandled_event(Display *dpy, XEvent *event, XPointer arg);
 static void reset_root_atoms(Display *display, Window root, Pixmap pixmap);
+static int wm_running(Window root, Atom check);
 
 static Display *display = NULL;
 static int x11_initialized = 0;
+/* queried once, as every query is a round trip that might queue events */
+static int have_rr = 0, rr_event_base = 0, have_xi = 0, xi_opcode = -1;
+
+int ignore_errors(Display *dpy, XErrorEvent *error) {
+    (void) dpy;
+    (void) error;
+    return 0;
+}
 
 void reset_root_atoms(Display *dpy, Window root, Pixmap pixmap) {
     Atom atom_root, atom_eroot, type;
@@ -60,6 +74,7 @@ int x11_connection_number(void) {
 }
 
 int x11_init(void) {
+    int ignore;
     XIEventMask ximask;
     unsigned char mask[2] = { 0 };
 
@@ -72,6 +87,8 @@ int x11_init(void) {
         fprintf(stderr, "ERROR: Unable to open X11 display\n");
         return 0;
     }
+    have_rr = XRRQueryExtension(display, &rr_event_base, &ignore);
+    have_xi = XQueryExtension(display, "XInputExtension", &xi_opcode, &ignore, &ignore);
 
     XRRSelectInput(display, XDefaultRootWindow(display),
             RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask |
@@ -89,15 +106,21 @@ int x11_init(void) {
     return 1;
 }
 
+int x11_pending(void) {
+    XEvent event;
+
+    if (!display)
+        return 0;
+    /* events nobody checks for would keep the queue from ever becoming empty */
+    while (XCheckIfEvent(display, &event, &unhandled_event, NULL));
+    return XEventsQueued(display, QueuedAlready);
+}
+
 int x11_screen_has_changed(void) {
-    int have_rr, rr_event_base, rr_error_base;
     int screen_changed = 0;
-    if (!display)
+    if (!display || !have_rr)
         return 0;
     XEvent event;
-    have_rr = XRRQueryExtension (display, &rr_event_base, &rr_error_base);
-    if (!have_rr)
-        return 0;
     while (XCheckTypedEvent(display, rr_event_base + RRScreenChangeNotify, &event)
             || XCheckTypedEvent(display, rr_event_base + RRNotify, &event)) {
         /* if (event.type == rr_event_base + RRScreenChangeNotify) */
@@ -112,28 +135,33 @@ int x11_screen_has_changed(void) {
 }
 
 int x11_keyboard_has_changed(void) {
-    int have_xi, xi_op, ignore;
     int keyboard_changed = 0;
     XIHierarchyEvent *hev;
 
-    if (!display)
+    if (!display || !have_xi)
         return 0;
     XEvent event;
-    have_xi = XQueryExtension(display, "XInputExtension", &xi_op, &ignore, &ignore);
-    if (!have_xi)
-        return 0;
     while (XCheckTypedEvent(display, GenericEvent, &event)) {
-        if (event.xcookie.extension == xi_op
+        if (event.xcookie.extension == xi_opcode
                 && event.xcookie.evtype == XI_HierarchyChanged
                 && XGetEventData(display, &event.xcookie)) {
             hev = event.xcookie.data;
             if (hev->flags & XIDeviceEnabled)
                 keyboard_changed = 1;
+            XFreeEventData(display, &event.xcookie);
         }
     }
     return keyboard_changed;
 }
 
+Bool unhandled_event(Display *dpy, XEvent *event, XPointer arg) {
+    (void) dpy;
+    (void) arg;
+    if (have_rr && (event->type == rr_event_base + RRScreenChangeNotify || event->type == rr_event_base + RRNotify))
+        return False;
+    return !(have_xi && event->type == GenericEvent && event->xcookie.extension == xi_opcode);
+}
+
 int x11_wallpaper_all(const char *path) {
 #ifdef IMLIB2
     unsigned int dpy_width, dpy_height, new_width, new_height, uidummy;
@@ -239,6 +267,88 @@ int x11_wallpaper_all(const char *path) {
 #endif /* IMLIB2 */
 }
 
+int x11_wait_wm(long timeout_milli, int fd) {
+    int running, status;
+    long remaining;
+    Window root;
+    Atom check;
+    XEvent event;
+    struct pollfd fds[2];
+    struct timespec start, now;
+
+    if (!display || clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        return 0;
+
+    /* an EWMH compliant window manager wakes us up by announcing itself on the root window */
+    root = XDefaultRootWindow(display);
+    check = XInternAtom(display, "_NET_SUPPORTING_WM_CHECK", False);
+    XSelectInput(display, root, PropertyChangeMask);
+
+    for (;;) {
+        while (XCheckTypedWindowEvent(display, root, PropertyNotify, &event));
+        running = wm_running(root, check);
+        if (running || clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+            break;
+        remaining = timeout_milli - (now.tv_sec - start.tv_sec) * 1000 - (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (remaining <= 0)
+            break;
+
+        /* taking over SubstructureRedirect does not generate any event, so it is checked periodically */
+        fds[0].fd = XConnectionNumber(display);
+        fds[1].fd = fd;
+        fds[0].events = fds[1].events = POLLIN;
+        fds[0].revents = fds[1].revents = 0;
+        status = poll(fds, fd >= 0 ? 2 : 1, (int) (remaining < X11_WM_POLL_INTERVAL ? remaining : X11_WM_POLL_INTERVAL));
+        if (status == -1 && errno != EINTR)
+            break;
+        /* the window manager has terminated */
+        if (status > 0 && fd >= 0 && fds[1].revents)
+            break;
+    }
+
+    /* the main loop only checks for RandR and XInput events, so nothing may be left in the queue */
+    XSelectInput(display, root, NoEventMask);
+    XSync(display, False);
+    while (XCheckTypedWindowEvent(display, root, PropertyNotify, &event));
+    return running;
+}
+
+int wm_running(Window root, Atom check) {
+    int format, running = 0;
+    unsigned long length, after;
+    unsigned char *data = NULL;
+    Atom type;
+    Window window = None;
+    XWindowAttributes attributes;
+    XErrorHandler previous;
+
+    /* only one client can select SubstructureRedirect on the root window: the window manager */
+    if (XGetWindowAttributes(display, root, &attributes) && (attributes.all_event_masks & SubstructureRedirectMask))
+        return 1;
+
+    if (XGetWindowProperty(display, root, check, 0L, 1L, False, XA_WINDOW, &type, &format, &length, &after,
+                &data) != Success)
+        return 0;
+    if (data && type == XA_WINDOW && format == 32 && length == 1)
+        window = *((Window *) data);
+    if (data)
+        XFree(data);
+    if (window == None)
+        return 0;
+
+    /* the property might be left over from a previous window manager, so the window has to confirm it */
+    previous = XSetErrorHandler(&ignore_errors);
+    data = NULL;
+    if (XGetWindowProperty(display, window, check, 0L, 1L, False, XA_WINDOW, &type, &format, &length, &after,
+                &data) == Success && data && type == XA_WINDOW && format == 32 && length == 1)
+        running = *((Window *) data) == window;
+    XSync(display, False);
+    XSetErrorHandler(previous);
+    if (data)
+        XFree(data);
+    return running;
+}
+
 void x11_deinit(void) {
     if (!x11_initialized)
         return;
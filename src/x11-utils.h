@@ -1,10 +1,26 @@
 #ifndef H_X11_UTILS
 #define H_X11_UTILS
 
+#define X11_WM_POLL_INTERVAL    50 /* milliseconds */
+
 int x11_connection_number(void);
 int x11_init(void);
+/*
+ * number of events already read by Xlib, which do not wake up a poll on the connection
+ *
+ * drops events that are not checked by the *_has_changed() functions
+ */
+int x11_pending(void);
 int x11_screen_has_changed(void);
 int x11_keyboard_has_changed(void);
+/*
+ * wait until a window manager is running or timeout_milli milliseconds have passed
+ *
+ * a window manager is detected by _NET_SUPPORTING_WM_CHECK or by it selecting SubstructureRedirect
+ * on the root window, the wait ends early once fd (e.g. the pidfd of the window manager) is readable
+ * returns 1 if a window manager is running, 0 otherwise
+ */
+int x11_wait_wm(long timeout_milli, int fd);
 int x11_wallpaper_all(const char *path);
 void x11_deinit(void);
 